@@ -0,0 +1,9 @@
+// The baseline hash map, with its functions renamed so it can live next to the current one
+#define hash_map_create baseline_hash_map_create
+#define hash_map_put baseline_hash_map_put
+#define hash_map_get baseline_hash_map_get
+#define hash_map_delete baseline_hash_map_delete
+#define hash_map_destroy baseline_hash_map_destroy
+#define hash_map_for_each_entry baseline_hash_map_for_each_entry
+#define HASH_MAP_IMPLEMENT
+#include "baseline_hash_map.h"
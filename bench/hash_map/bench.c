@@ -0,0 +1,243 @@
+// The kernel headers declare their own printf, which conflicts with the one of the C library
+#define printf rawos_printf
+#define vprintf rawos_vprintf
+#define HASH_MAP_IMPLEMENT
+#include "../../src/hash_map.h"
+#undef printf
+#undef vprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+	Host benchmark of the kernel hash map (src/hash_map.h), compared with the baseline (the layout before the hashes were
+	moved to their own array, see baseline_hash_map.h).
+
+	Each workload fills a map with N keys and then measures how many lookups per second it does, both for keys that are
+	in the map (hits) and keys that are not (misses). The keys mimic the two kinds of maps the kernel has:
+	- frames: u32 keys hashed with the identity function, like frame numbers. The frames are multiples of 16, like
+	  blocks of 16 contiguous frames.
+	- names: string keys hashed with djb2, like the syscall stubs.
+
+	Before measuring, both implementations go through a random sequence of puts and deletes, checked against a plain array.
+*/
+
+#define BENCH_LOOKUPS (1 << 22)
+#define BENCH_CHECK_KEYS 4096
+#define BENCH_CHECK_OPS 1000000
+#define BENCH_MAX_KEYS (1 << 20)
+#define BENCH_NAME_MAX_LENGTH 16
+
+typedef struct {
+	const s8* name;
+	s32 (*create)(Hash_Map* hm, u32 initial_capacity, u32 key_size, u32 value_size, Key_Compare_Func key_compare_func,
+		Key_Hash_Func key_hash_func);
+	s32 (*put)(Hash_Map* hm, const void* key, const void* value);
+	s32 (*get)(Hash_Map* hm, const void* key, void* value);
+	s32 (*delete)(Hash_Map* hm, const void* key);
+	void (*destroy)(Hash_Map* hm);
+} Implementation;
+
+typedef struct {
+	const s8* name;
+	u32 key_size;
+	Key_Compare_Func key_compare_func;
+	Key_Hash_Func key_hash_func;
+	// Writes the key number 'i' to 'key'. Keys with different numbers are different.
+	void (*make_key)(u32 i, void* key);
+} Key_Kind;
+
+s32 baseline_hash_map_create(Hash_Map* hm, u32 initial_capacity, u32 key_size, u32 value_size,
+	Key_Compare_Func key_compare_func, Key_Hash_Func key_hash_func);
+s32 baseline_hash_map_put(Hash_Map* hm, const void* key, const void* value);
+s32 baseline_hash_map_get(Hash_Map* hm, const void* key, void* value);
+s32 baseline_hash_map_delete(Hash_Map* hm, const void* key);
+void baseline_hash_map_destroy(Hash_Map* hm);
+
+static const Implementation implementations[] = {
+	{ "baseline", baseline_hash_map_create, baseline_hash_map_put, baseline_hash_map_get, baseline_hash_map_delete,
+		baseline_hash_map_destroy },
+	{ "current", hash_map_create, hash_map_put, hash_map_get, hash_map_delete, hash_map_destroy },
+};
+#define NUM_IMPLEMENTATIONS (sizeof(implementations) / sizeof(implementations[0]))
+
+void* kalloc_alloc(u32 size) {
+	return malloc(size);
+}
+
+void kalloc_free(void* ptr) {
+	free(ptr);
+}
+
+void assert(s32 condition, const s8* message, ...) {
+	if (!condition) {
+		fprintf(stderr, "%s\n", message);
+		abort();
+	}
+}
+
+static u32 rand_state = 0x2545F491;
+static u32 bench_rand() {
+	// xorshift32
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static u64 now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ******************** */
+/*      KEY KINDS       */
+/* ******************** */
+
+static s32 frame_compare(const void* key1, const void* key2) {
+	return *(u32*)key1 == *(u32*)key2;
+}
+
+static u32 frame_hash(const void* key) {
+	return *(u32*)key;
+}
+
+static void make_frame_key(u32 i, void* key) {
+	*(u32*)key = 0x100 + i * 16;
+}
+
+// The keys are pointers to the names (just like the syscall names), so they are all made up front.
+// There are twice as many names as keys, since the misses are looked up with the keys after the ones in the map.
+static s8 names[2 * BENCH_MAX_KEYS][BENCH_NAME_MAX_LENGTH];
+
+static void init_names() {
+	for (u32 i = 0; i < 2 * BENCH_MAX_KEYS; ++i) {
+		snprintf(names[i], BENCH_NAME_MAX_LENGTH, "syscall_%u", i);
+	}
+}
+
+static s32 name_compare(const void* key1, const void* key2) {
+	return !strcmp(*(s8**)key1, *(s8**)key2);
+}
+
+static u32 name_hash(const void* key) {
+	const s8* str = *(const s8**)key;
+	u32 hash = 5381;
+	s32 c;
+	while ((c = *str++)) {
+		hash = ((hash << 5) + hash) + c;
+	}
+	return hash;
+}
+
+static void make_name_key(u32 i, void* key) {
+	*(s8**)key = names[i];
+}
+
+static const Key_Kind key_kinds[] = {
+	{ "frames", sizeof(u32), frame_compare, frame_hash, make_frame_key },
+	{ "names", sizeof(s8*), name_compare, name_hash, make_name_key },
+};
+
+/* ******************** */
+/*       CHECKS         */
+/* ******************** */
+
+// Random puts (new keys and updates) and deletes, checking every get against a plain array of values (0 if not in the map)
+static void check_implementation(const Implementation* impl, const Key_Kind* kind) {
+	static u32 expected[BENCH_CHECK_KEYS];
+	memset(expected, 0, sizeof(expected));
+	Hash_Map hm;
+	impl->create(&hm, 1, kind->key_size, sizeof(u32), kind->key_compare_func, kind->key_hash_func);
+	u64 key[2];
+	for (u32 i = 0; i < BENCH_CHECK_OPS; ++i) {
+		u32 key_num = bench_rand() % BENCH_CHECK_KEYS;
+		kind->make_key(key_num, key);
+		u32 op = bench_rand() % 3;
+		if (op == 0) {
+			u32 value = i + 1;
+			assert(!impl->put(&hm, key, &value), "put failed");
+			expected[key_num] = value;
+		} else if (op == 1) {
+			s32 deleted = !impl->delete(&hm, key);
+			assert(deleted == (expected[key_num] != 0), "delete returned the wrong result");
+			expected[key_num] = 0;
+		} else {
+			u32 value;
+			s32 found = !impl->get(&hm, key, &value);
+			assert(found == (expected[key_num] != 0), "get returned the wrong result");
+			assert(!found || value == expected[key_num], "get returned the wrong value");
+		}
+	}
+	u32 num_elements = 0;
+	for (u32 i = 0; i < BENCH_CHECK_KEYS; ++i) {
+		num_elements += expected[i] != 0;
+	}
+	assert(hm.num_elements == num_elements, "wrong number of elements");
+	impl->destroy(&hm);
+}
+
+/* ******************** */
+/*      BENCHMARK       */
+/* ******************** */
+
+// Returns the number of lookups per second. Keys from 'first_key' to 'first_key + num_keys - 1' are looked up at random.
+static r64 measure_lookups(const Implementation* impl, const Key_Kind* kind, Hash_Map* hm, u32 first_key, u32 num_keys,
+	s32 expect_found) {
+	// The keys are made up front, so only the lookups are measured
+	u64* keys = malloc(BENCH_LOOKUPS * sizeof(u64));
+	for (u32 i = 0; i < BENCH_LOOKUPS; ++i) {
+		kind->make_key(first_key + bench_rand() % num_keys, &keys[i]);
+	}
+	u32 found = 0;
+	u64 start = now_ns();
+	for (u32 i = 0; i < BENCH_LOOKUPS; ++i) {
+		u32 value;
+		found += !impl->get(hm, &keys[i], &value);
+	}
+	u64 elapsed = now_ns() - start;
+	assert(found == (expect_found ? BENCH_LOOKUPS : 0), "lookups returned the wrong result");
+	free(keys);
+	return BENCH_LOOKUPS / (elapsed / 1e9);
+}
+
+static void run(const Key_Kind* kind, u32 num_keys) {
+	r64 hits[NUM_IMPLEMENTATIONS], misses[NUM_IMPLEMENTATIONS];
+	for (u32 i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+		const Implementation* impl = &implementations[i];
+		Hash_Map hm;
+		// Like the kernel maps, the map starts small and grows while it is filled
+		impl->create(&hm, 16, kind->key_size, sizeof(u32), kind->key_compare_func, kind->key_hash_func);
+		u64 key;
+		for (u32 k = 0; k < num_keys; ++k) {
+			kind->make_key(k, &key);
+			impl->put(&hm, &key, &k);
+		}
+		hits[i] = measure_lookups(impl, kind, &hm, 0, num_keys, 1);
+		misses[i] = measure_lookups(impl, kind, &hm, num_keys, num_keys, 0);
+		impl->destroy(&hm);
+	}
+	printf("%-8s %8u %12.2f %12.2f %8.2fx %12.2f %12.2f %8.2fx\n", kind->name, num_keys,
+		hits[0] / 1e6, hits[1] / 1e6, hits[1] / hits[0], misses[0] / 1e6, misses[1] / 1e6, misses[1] / misses[0]);
+}
+
+s32 main() {
+	init_names();
+	for (u32 i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+		for (u32 k = 0; k < sizeof(key_kinds) / sizeof(key_kinds[0]); ++k) {
+			check_implementation(&implementations[i], &key_kinds[k]);
+		}
+	}
+
+	printf("Lookups per second (millions)\n");
+	printf("%-8s %8s %12s %12s %9s %12s %12s %9s\n", "keys", "size", "hit base", "hit cur", "speedup", "miss base", "miss cur",
+		"speedup");
+	u32 sizes[] = { 16, 1024, 65536, BENCH_MAX_KEYS };
+	for (u32 k = 0; k < sizeof(key_kinds) / sizeof(key_kinds[0]); ++k) {
+		for (u32 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+			run(&key_kinds[k], sizes[s]);
+		}
+	}
+	return 0;
+}
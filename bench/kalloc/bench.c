@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "../../src/alloc/kalloc_heap.h"
+#include "mock.h"
+
+/*
+	Host benchmark of the kernel heap (src/alloc/kalloc_heap.c).
+
+	Every workload is a list of heap operations, replayed twice on a brand new heap: once to measure the throughput and
+	once more to measure the latency of each operation. Workloads come from the synthetic generators below and from the
+	trace files given in the command line.
+
+	Trace format, one operation per line ('#' starts a comment):
+
+	a <id> <size> [alignment]: allocates a block, which is called <id> from now on
+	f <id>: frees block <id>
+	r <id> <size>: reallocs block <id>
+
+	Ids must be smaller than BENCH_MAX_IDS, and only blocks that are alive can be freed or realloc'd. Blocks that are still
+	alive at the end are freed, but that is not measured.
+
+	The kernel writes its heap operations in this format when KALLOC_RECORD_TRACE is defined (see kalloc_heap.h). Run it
+	with 'make trace' and copy bin/kalloc.trace to bench/kalloc/traces.
+*/
+
+#define BENCH_MAX_IDS (1 << 20)
+// Maximum number of processes alive at the same time in the fork-exec-churn workload, and blocks owned by each one
+#define BENCH_MAX_PROCESSES 16
+#define BENCH_PROCESS_BLOCKS 8
+
+#define OP_ALLOC 'a'
+#define OP_FREE 'f'
+#define OP_REALLOC 'r'
+
+typedef struct {
+	u8 type;
+	u32 id;
+	u32 size;
+	u32 alignment;
+} Op;
+
+typedef struct {
+	const s8* name;
+	Op* ops;
+	u32 num_ops;
+	u32 capacity;
+	// Live ids, used by the generators to pick blocks to free
+	u32* live_ids;
+	u32 num_live_ids;
+	u32 next_id;
+} Workload;
+
+typedef struct {
+	r64 seconds;
+	u32 p50_ns;
+	u32 p99_ns;
+	u32 max_ns;
+	u32 peak_heap_size;
+	u32 peak_used_bytes;
+	Kalloc_Heap_Statistics end_statistics;
+} Result;
+
+static Kalloc_Heap heap;
+static void* blocks[BENCH_MAX_IDS];
+
+/* ******************** */
+/*      WORKLOADS       */
+/* ******************** */
+
+static u32 rand_state = 0x2545F491;
+static u32 bench_rand() {
+	// xorshift32
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static u32 rand_range(u32 min, u32 max) {
+	return min + bench_rand() % (max - min + 1);
+}
+
+static void workload_init(Workload* workload, const s8* name) {
+	memset(workload, 0, sizeof(Workload));
+	workload->name = name;
+	workload->live_ids = malloc(BENCH_MAX_IDS * sizeof(u32));
+}
+
+static void workload_destroy(Workload* workload) {
+	free(workload->ops);
+	free(workload->live_ids);
+}
+
+static void push_op(Workload* workload, u8 type, u32 id, u32 size, u32 alignment) {
+	if (workload->num_ops == workload->capacity) {
+		workload->capacity = workload->capacity ? workload->capacity * 2 : 1024;
+		workload->ops = realloc(workload->ops, workload->capacity * sizeof(Op));
+	}
+	Op* op = &workload->ops[workload->num_ops++];
+	op->type = type;
+	op->id = id;
+	op->size = size;
+	op->alignment = alignment;
+}
+
+// Returns the id of the new block
+static u32 gen_alloc(Workload* workload, u32 size, u32 alignment) {
+	u32 id = workload->next_id++;
+	push_op(workload, OP_ALLOC, id, size, alignment);
+	workload->live_ids[workload->num_live_ids++] = id;
+	return id;
+}
+
+static void gen_free_at(Workload* workload, u32 live_index) {
+	push_op(workload, OP_FREE, workload->live_ids[live_index], 0, 0);
+	workload->live_ids[live_index] = workload->live_ids[--workload->num_live_ids];
+}
+
+static void gen_free_random(Workload* workload) {
+	gen_free_at(workload, bench_rand() % workload->num_live_ids);
+}
+
+static void gen_free_id(Workload* workload, u32 id) {
+	for (u32 i = workload->num_live_ids; i > 0; --i) {
+		if (workload->live_ids[i - 1] == id) {
+			gen_free_at(workload, i - 1);
+			return;
+		}
+	}
+}
+
+// Processes being forked, exec'd and destroyed: each one has a few small structures, a file descriptor table that grows
+// and a big image buffer, all freed together when the process exits.
+static void gen_fork_exec_churn(Workload* workload) {
+	u32 processes[BENCH_MAX_PROCESSES][BENCH_PROCESS_BLOCKS];
+	u32 num_processes = 0;
+
+	for (u32 i = 0; i < 20000; ++i) {
+		if (num_processes < 2 || (num_processes < BENCH_MAX_PROCESSES && bench_rand() % 2)) {
+			u32* process = processes[num_processes++];
+			process[0] = gen_alloc(workload, 160, 0);							// process
+			process[1] = gen_alloc(workload, 16 * 12, 0);						// file descriptors
+			process[2] = gen_alloc(workload, rand_range(8 * 1024, 64 * 1024), 0);	// image buffer
+			for (u32 j = 3; j < BENCH_PROCESS_BLOCKS; ++j) {
+				process[j] = gen_alloc(workload, 24, 0);						// virtual memory areas
+			}
+			if (bench_rand() % 4 == 0) {
+				push_op(workload, OP_REALLOC, process[1], 32 * 12, 0);
+			}
+		} else {
+			u32 index = bench_rand() % num_processes;
+			for (u32 j = 0; j < BENCH_PROCESS_BLOCKS; ++j) {
+				gen_free_id(workload, processes[index][j]);
+			}
+			memcpy(processes[index], processes[--num_processes], sizeof(processes[index]));
+		}
+	}
+}
+
+// Lots of small objects with a big live set
+static void gen_small_object_storm(Workload* workload) {
+	const u32 live_target = 50000;
+	for (u32 i = 0; i < 1000000; ++i) {
+		u32 alloc_chance = workload->num_live_ids < live_target ? 60 : 40;
+		if (workload->num_live_ids == 0 || bench_rand() % 100 < alloc_chance) {
+			gen_alloc(workload, (8 << (bench_rand() % 5)) + bench_rand() % 8, 0);
+		} else {
+			gen_free_random(workload);
+		}
+	}
+}
+
+// Page-aligned pages (page tables) mixed with small long-lived objects, with the pages freed in batches
+static void gen_aligned_page_tables(Workload* workload) {
+	u32 tables[64];
+	for (u32 round = 0; round < 2000; ++round) {
+		u32 num_tables = rand_range(4, 64);
+		for (u32 i = 0; i < num_tables; ++i) {
+			tables[i] = gen_alloc(workload, 4096, 4096);
+			if (bench_rand() % 2) {
+				gen_alloc(workload, rand_range(16, 256), 0);
+			}
+		}
+		for (u32 i = 0; i < num_tables; ++i) {
+			gen_free_id(workload, tables[i]);
+		}
+		// Some of the small objects die too
+		while (workload->num_live_ids > 2000) {
+			gen_free_random(workload);
+		}
+	}
+}
+
+static s32 load_trace(Workload* workload, const s8* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "error opening trace %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	s8 line[256];
+	u32 line_num = 0;
+	while (fgets(line, sizeof(line), file)) {
+		++line_num;
+		s8 type;
+		u32 id = 0, size = 0, alignment = 0;
+		s32 fields = sscanf(line, " %c %u %u %u", &type, &id, &size, &alignment);
+		if (fields <= 0 || type == '#') {
+			continue;
+		}
+		s32 valid = id < BENCH_MAX_IDS && ((type == OP_ALLOC && fields >= 3) || (type == OP_FREE && fields == 2) ||
+			(type == OP_REALLOC && fields == 3));
+		if (!valid) {
+			fprintf(stderr, "%s:%u: invalid operation\n", path, line_num);
+			fclose(file);
+			return -1;
+		}
+		push_op(workload, type, id, size, alignment);
+	}
+	fclose(file);
+	return 0;
+}
+
+/* ******************** */
+/*        REPLAY        */
+/* ******************** */
+
+static u64 now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void run_op(const Op* op) {
+	switch (op->type) {
+		case OP_ALLOC: blocks[op->id] = kalloc_heap_alloc(&heap, op->size, op->alignment); break;
+		case OP_FREE: kalloc_heap_free(&heap, blocks[op->id]); blocks[op->id] = 0; break;
+		case OP_REALLOC: blocks[op->id] = kalloc_heap_realloc(&heap, blocks[op->id], op->size); break;
+	}
+}
+
+static void create_heap() {
+	kalloc_heap_create(&heap, BENCH_HEAP_ADDRESS, 1);
+	// Same as kalloc_init: the heap can't start with an aligned allocation
+	kalloc_heap_alloc(&heap, 1, 0);
+}
+
+static void destroy_heap(const Workload* workload) {
+	for (u32 i = 0; i < workload->num_ops; ++i) {
+		u32 id = workload->ops[i].id;
+		if (blocks[id]) {
+			kalloc_heap_free(&heap, blocks[id]);
+			blocks[id] = 0;
+		}
+	}
+	bench_release_heap_memory();
+}
+
+static s32 compare_u32(const void* a, const void* b) {
+	u32 x = *(const u32*)a, y = *(const u32*)b;
+	return (x > y) - (x < y);
+}
+
+static void replay(const Workload* workload, Result* result) {
+	memset(result, 0, sizeof(Result));
+
+	// First pass: throughput and fragmentation
+	create_heap();
+	u64 start = now_ns();
+	for (u32 i = 0; i < workload->num_ops; ++i) {
+		run_op(&workload->ops[i]);
+		result->peak_heap_size = MAX(result->peak_heap_size, heap.size);
+	}
+	result->seconds = (now_ns() - start) / 1e9;
+	kalloc_heap_get_statistics(&heap, &result->end_statistics);
+	result->peak_used_bytes = result->end_statistics.peak_used_bytes;
+	destroy_heap(workload);
+
+	// Second pass: latency of each operation
+	u32* latencies = malloc(workload->num_ops * sizeof(u32));
+	create_heap();
+	for (u32 i = 0; i < workload->num_ops; ++i) {
+		u64 op_start = now_ns();
+		run_op(&workload->ops[i]);
+		latencies[i] = (u32)(now_ns() - op_start);
+	}
+	destroy_heap(workload);
+
+	qsort(latencies, workload->num_ops, sizeof(u32), compare_u32);
+	result->p50_ns = latencies[workload->num_ops / 2];
+	result->p99_ns = latencies[(u32)((u64)workload->num_ops * 99 / 100)];
+	result->max_ns = latencies[workload->num_ops - 1];
+	free(latencies);
+}
+
+static void print_result(const Workload* workload, const Result* result) {
+	const Kalloc_Heap_Statistics* statistics = &result->end_statistics;
+	u32 free_bytes = statistics->heap_size - statistics->used_bytes;
+	// How much of the free memory can't be used by a single allocation (0% when all free memory is a single hole)
+	r64 fragmentation = free_bytes ? 100.0 * (1.0 - (r64)statistics->largest_hole / free_bytes) : 0.0;
+	printf("%-24s %9u %9.2f %8u %8u %9u %12u %12u %12u %8.1f%%\n", workload->name, workload->num_ops,
+		workload->num_ops / result->seconds / 1e6, result->p50_ns, result->p99_ns, result->max_ns, result->peak_heap_size / 1024,
+		result->peak_used_bytes / 1024, statistics->heap_size / 1024, fragmentation);
+}
+
+static void run_workload(Workload* workload) {
+	if (workload->num_ops == 0) {
+		printf("%-24s (empty)\n", workload->name);
+		return;
+	}
+	Result result;
+	replay(workload, &result);
+	print_result(workload, &result);
+}
+
+s32 main(s32 argc, s8** argv) {
+	bench_reserve_heap_memory();
+#ifdef TLSF_HEAP_ENABLED
+	printf("Hole index: TLSF\n");
+#else
+	printf("Hole index: AVL\n");
+#endif
+	printf("%-24s %9s %9s %8s %8s %9s %12s %12s %12s %9s\n", "workload", "ops", "Mops/s", "p50 ns", "p99 ns", "max ns",
+		"peak heap KB", "peak used KB", "end heap KB", "end frag");
+
+	Workload workload;
+	workload_init(&workload, "fork-exec-churn");
+	gen_fork_exec_churn(&workload);
+	run_workload(&workload);
+	workload_destroy(&workload);
+
+	workload_init(&workload, "small-object-storm");
+	gen_small_object_storm(&workload);
+	run_workload(&workload);
+	workload_destroy(&workload);
+
+	workload_init(&workload, "aligned-page-tables");
+	gen_aligned_page_tables(&workload);
+	run_workload(&workload);
+	workload_destroy(&workload);
+
+	for (s32 i = 1; i < argc; ++i) {
+		workload_init(&workload, strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i]);
+		if (load_trace(&workload, argv[i])) {
+			return 1;
+		}
+		run_workload(&workload);
+		workload_destroy(&workload);
+	}
+	return 0;
+}
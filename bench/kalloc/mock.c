@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include "mock.h"
+#include "../../src/paging.h"
+
+#define PAGE_SIZE 4096
+#define HEAP_MEMORY_SIZE (FRAME_REFERENCE_COUNTS_ADDRESS - BENCH_HEAP_ADDRESS)
+
+// The whole range that the heap might use is reserved up front, but pages are only accessible after the heap creates them.
+// This way, the heap crashes the benchmark if it touches a page that it doesn't own, just like it would crash the kernel.
+static u32 mapped_pages = 0;
+
+void bench_reserve_heap_memory() {
+	void* addr = mmap((void*)BENCH_HEAP_ADDRESS, HEAP_MEMORY_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+		-1, 0);
+	if (addr == MAP_FAILED) {
+		perror("error reserving memory for the heap");
+		exit(1);
+	}
+}
+
+// Gives all pages back, so the next heap starts from scratch
+void bench_release_heap_memory() {
+	madvise((void*)BENCH_HEAP_ADDRESS, HEAP_MEMORY_SIZE, MADV_DONTNEED);
+	mprotect((void*)BENCH_HEAP_ADDRESS, HEAP_MEMORY_SIZE, PROT_NONE);
+	mapped_pages = 0;
+}
+
+u32 bench_get_mapped_pages() {
+	return mapped_pages;
+}
+
+u32 paging_create_kernel_page_with_any_frame(u32 page_num) {
+	if (mprotect((void*)(page_num * PAGE_SIZE), PAGE_SIZE, PROT_READ | PROT_WRITE)) {
+		perror("error creating heap page");
+		exit(1);
+	}
+	++mapped_pages;
+	return page_num;
+}
+
+void paging_remove_kernel_page(u32 page_num) {
+	madvise((void*)(page_num * PAGE_SIZE), PAGE_SIZE, MADV_DONTNEED);
+	mprotect((void*)(page_num * PAGE_SIZE), PAGE_SIZE, PROT_NONE);
+	--mapped_pages;
+}
+
+void paging_tlb_flush() {
+}
+
+void assert(s32 condition, const s8* message, ...) {
+	if (!condition) {
+		va_list args;
+		va_start(args, message);
+		fprintf(stderr, "Assert failed: ");
+		vfprintf(stderr, message, args);
+		fprintf(stderr, "\n");
+		va_end(args);
+		abort();
+	}
+}
+
+void panic(const s8* message) {
+	fprintf(stderr, "Panic: %s\n", message);
+	abort();
+}
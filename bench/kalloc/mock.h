@@ -0,0 +1,12 @@
+#ifndef RAW_OS_BENCH_KALLOC_MOCK_H
+#define RAW_OS_BENCH_KALLOC_MOCK_H
+#include "../../src/common.h"
+// Mocks of the kernel functions used by the heap, so it can run as a regular (hosted) program.
+
+// Address of the benchmarked heap. It can grow until FRAME_REFERENCE_COUNTS_ADDRESS, just like the kernel heap.
+#define BENCH_HEAP_ADDRESS 0x10000000
+
+void bench_reserve_heap_memory();
+void bench_release_heap_memory();
+u32 bench_get_mapped_pages();
+#endif
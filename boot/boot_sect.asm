@@ -21,6 +21,9 @@ add esp, 2
 ;add esp, 4
 
 call load_kernel                ; loads the kernel to KERNEL_OFFSET
+xor ax, ax                      ; util_16bits_detect_memory writes to es:di, and the BIOS doesn't guarantee that es is 0
+mov es, ax
+call util_16bits_detect_memory  ; stores the memory map in MEMORY_MAP_ADDRESS, so the kernel knows which RAM is usable
 
 ;mov ax, 0x1000
 ;mov ds, ax
@@ -70,9 +73,9 @@ init_pm:
 ; The kernel is already large enough to overwrite the BIOS, which will lead to major issues during the bootstrap process.
 ; Later on, we might want to implement our own bootstrapper, and if it is small enough we can load it to 0x1000 (or any addr inside the 16-bit
 ; addres space)
-; Since now we are loading to 0x10000, the kernel code can grow until 0xFFFFF safely, and nothing below 0x10000 will be touched.
-; If, however, the kernel size reaches 0xFFFFF, then we will need to write the bootstrapper, since we will not be able to access higher
-; address in real mode.
+; Since now we are loading to 0x10000, the kernel code can grow until 0x80000 (where the boot stack starts, see BOOT_STACK_LIMIT
+; in paging.h), and nothing below 0x10000 will be touched. The build fails if the kernel gets bigger than that (see KERNEL_MAX_SECTORS).
+; Beyond that, we will need to write the bootstrapper, since we will not be able to access higher address in real mode.
 ; Address that we will jump to when starting the kernel.
 KERNEL_OFFSET_PROTECTED_MODE equ 0x10000
 ; Address that we will load the kernel
@@ -80,6 +83,22 @@ KERNEL_OFFSET_PROTECTED_MODE equ 0x10000
 KERNEL_OFFSET_REAL_MODE_SEGMENT equ 0x1000
 KERNEL_OFFSET_REAL_MODE equ 0x0000
 ; NOTE: These address MUST be the same! (the protected mode addr should be the same as the other after the evaluation)
+; Number of sectors of the kernel image. It is given by the Makefile, based on the size of kernel.bin.
+%ifndef KERNEL_SECTORS
+	%error "KERNEL_SECTORS must be defined (nasm -DKERNEL_SECTORS=...)"
+%endif
+; The kernel must end before the boot stack, which goes down from 0x90000 (see BOOT_STACK_LIMIT in paging.h).
+; NOTE: The preprocessor can't see 'equ' constants, so the kernel address (0x10000) is repeated here.
+%assign KERNEL_MAX_SECTORS (0x80000 - 0x10000) / 512
+%if KERNEL_SECTORS > KERNEL_MAX_SECTORS
+	%error "The kernel image does not fit in the memory reserved for it (see KERNEL_MAX_SECTORS)"
+%endif
+; 64 sectors (32KB) per read. Since the buffer starts at a 64KB boundary, a read never crosses one.
+KERNEL_SECTORS_PER_READ equ 64
+; Address in which the BIOS memory map is stored. It is located in free conventional memory, below the boot sector.
+; There is space for ~1200 entries before the boot sector, but the kernel only reads the first E820_MEMORY_MAP_MAX_ENTRIES.
+; NOTE: If this value is changed, we need to change in paging.h aswell.
+MEMORY_MAP_ADDRESS equ 0x500
 BOOT_DRIVE: db 0
 
 SWITCH_TO_PM_MSG: db 'Switched to protected mode!', 0
@@ -87,36 +106,44 @@ LOAD_KERNEL_MSG: db 'Loading kernel...', 0
 
 [bits 16]
 
+; Loads KERNEL_SECTORS sectors, starting right after the boot sector, to KERNEL_OFFSET.
+; A single BIOS call can't read the whole kernel, so we read KERNEL_SECTORS_PER_READ sectors at a time, moving the
+; segment of the buffer forward after each read.
 load_kernel:
-	push bp
-	mov bp, sp
-
-	push ax
-
-	; Move the kernel segment offset to the es segment register.
-	; BIOS will use this when loading the sectors.
-	mov ax, KERNEL_OFFSET_REAL_MODE_SEGMENT
-	mov es, ax
-
-	mov ah, 112                     ; Number of sectors to read
-									; for now load all sectors that we can, for dev purposes
-	mov al, [BOOT_DRIVE]            ; Read from boot drive
-	push ax
-	mov ah, 0                       ; Track/cylinder number
-	mov al, 2                       ; Start at sector 2
-	push ax
-	push 0x0                        ; Head number + padding
-	push KERNEL_OFFSET_REAL_MODE    ; Read sectors in this location (+ 16 * SEGMENT)
+	pusha
+
+	mov cx, KERNEL_SECTORS              ; cx has the number of sectors that still need to be read
+	load_kernel_loop:
+	mov ax, KERNEL_SECTORS_PER_READ
+	cmp cx, ax
+	jae load_kernel_read
+	mov ax, cx                          ; the last read might be smaller
+	load_kernel_read:
+	mov [KERNEL_DISK_ADDRESS_PACKET + 2], ax
+	sub cx, ax
+
+	push KERNEL_DISK_ADDRESS_PACKET
+	push word [BOOT_DRIVE]
 	call util_16bits_read_disk_sectors
-	add esp, 8                      ; clear stack (cdecl-like)
+	add sp, 4
 
-	mov ax, 0x0000
-	mov es, ax
+	add word [KERNEL_DISK_ADDRESS_PACKET + 6], KERNEL_SECTORS_PER_READ * 512 / 16    ; next segment
+	add word [KERNEL_DISK_ADDRESS_PACKET + 8], KERNEL_SECTORS_PER_READ               ; next sector
+	test cx, cx
+	jnz load_kernel_loop
 
-	pop ax
-	pop bp
+	popa
 	ret
 
+; Disk address packet used by util_16bits_read_disk_sectors (see INT 0x13, AH=0x42)
+KERNEL_DISK_ADDRESS_PACKET:
+	db 0x10                             ; size of the packet
+	db 0
+	dw 0                                ; number of sectors to read (set before each read)
+	dw KERNEL_OFFSET_REAL_MODE          ; buffer offset
+	dw KERNEL_OFFSET_REAL_MODE_SEGMENT  ; buffer segment
+	dq 1                                ; first sector (LBA). The kernel starts right after the boot sector
+
 %include "boot/util_16bits.asm"
 %include "boot/util.asm"
 %include "boot/gdt.asm"
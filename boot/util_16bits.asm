@@ -1,46 +1,23 @@
 [bits 16]
 
-; Read N sectors from disk, using BIOS
+; Read sectors from disk, using BIOS (INT 0x13 extensions, LBA addressing)
 ; Arguments (Push order):
-; Number of sectors to read (8 bits) [H]
-; Drive number (8 bits) [L]
-; Track/cylinder number (8 bits) [H]
-; Sector number (8 bits) [L]
-; Head number (8 bits) [H]
-; Padding (8 bits) [L]
-; buffer address (16 bits) [note: caller needs to set es register]
+; Pointer to the disk address packet, which has the number of sectors, the buffer and the first sector (16 bits)
+; Drive number (8 bits) [L] + padding (8 bits) [H]
 util_16bits_read_disk_sectors:
 	push bp
 	mov bp, sp
 
-	push ax
-	push bx
-	push cx
-	push dx
+	pusha
 
-	mov bx, [bp + 0x4]      ; now bx has the buffer address
-	mov ax, [bp + 0x6]      ; now ah has the head number
-	mov cx, [bp + 0x8]      ; now ch has the track/cylinder number and cl has the sector number
-	mov dx, [bp + 0xA]      ; now dh has the # of sectors and dl has the drive number
-
-	mov al, dh              ; BIOS expects # of sectors in al
-	mov dh, ah              ; BIOS expects head number in dh
-	mov ah, 0x02            ; BIOS expects ah=0x2 and INT 0x13 to read disk sectors
-	; BIOS expects track/cylinder number in ch and sector number in cl. They are already correct
-	; BIOS expects drive number in dl. It is already correct
-
-	int 0x13                ; call BIOS to read the sector
+	mov dx, [bp + 0x4]      ; now dl has the drive number
+	mov si, [bp + 0x6]      ; now si has the pointer to the disk address packet
+	mov ah, 0x42            ; BIOS expects ah=0x42 and INT 0x13 to read disk sectors (extended read)
+	int 0x13                ; call BIOS to read the sectors
 
 	jc util_16bits_read_disk_sectors_error
 
-	mov dx, [bp + 0xA]      ; restore number # sectors in dh
-	cmp dh, al
-	jne util_16bits_read_disk_sectors_error
-
-	pop dx
-	pop cx
-	pop bx
-	pop ax
+	popa
 
 	pop bp
 	ret
@@ -52,6 +29,39 @@ util_16bits_read_disk_sectors:
 
 	DISK_ERROR_MSG db "Error reading from disk", 0
 
+; Collect the physical memory map, using BIOS (INT 0x15, EAX=0xE820)
+; The map is stored at MEMORY_MAP_ADDRESS: the number of entries (32 bits), followed by the entries (24 bytes each).
+; If the BIOS doesn't support E820, the number of entries will be 0. The list stops at the first entry that the BIOS doesn't
+; sign with 'SMAP'.
+; NOTE: This needs to be small, since the boot sector is almost full. The caller needs to set es to 0.
+; No arguments.
+util_16bits_detect_memory:
+	pusha
+
+	mov di, MEMORY_MAP_ADDRESS + 4  ; BIOS writes each entry to es:di
+	xor ebx, ebx                    ; ebx must be 0 in the first call. BIOS updates it to continue the list
+	xor ebp, ebp                    ; ebp has the number of entries
+
+	util_16bits_detect_memory_loop:
+	mov eax, 0xE820
+	mov ecx, 24                     ; ask for 24-byte (ACPI 3.0) entries
+	mov edx, 0x534D4150             ; 'SMAP'
+	int 0x15
+	jc util_16bits_detect_memory_end        ; carry means that the list is over (or that E820 is not supported)
+	cmp eax, 0x534D4150             ; the BIOS returns 'SMAP' in eax. Otherwise, the entry can't be trusted
+	jne util_16bits_detect_memory_end
+
+	inc bp
+	add di, 24
+	test ebx, ebx                   ; ebx is 0 after the last entry
+	jnz util_16bits_detect_memory_loop
+
+	util_16bits_detect_memory_end:
+	mov [MEMORY_MAP_ADDRESS], ebp
+
+	popa
+	ret
+
 ; Print N bytes in hex, using BIOS
 ; Arguments (Push order):
 ; Pointer to content that should be printed (16 bits)
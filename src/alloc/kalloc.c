@@ -1,38 +1,173 @@
 #include "kalloc.h"
 #include "kalloc_heap.h"
 #include "../util/util.h"
+#include "../process.h"
+#include "../timer.h"
+#include "../asm/io.h"
 
 Kalloc_Heap heap;
 
+#ifdef KALLOC_TRACK_CALLERS
+static void* tag_block(void* ptr, void* caller) {
+	kalloc_heap_tag_block(&heap, ptr, (u32)caller, process_get_active_pid(), timer_get_uptime_seconds());
+	return ptr;
+}
+// Blocks are tagged with the address the allocation function returns to, i.e. the code that called it
+#define TAG_BLOCK(ptr) tag_block((ptr), __builtin_return_address(0))
+#else
+#define TAG_BLOCK(ptr) (ptr)
+#endif
+
+#ifdef KALLOC_RECORD_TRACE
+// The trace is written to the QEMU debug console (-debugcon), which writes every byte sent to this port to a file
+#define TRACE_PORT 0xE9
+// Maximum number of blocks alive at the same time. The id of a block in the trace is its index here.
+#define TRACE_MAX_BLOCKS 4096
+
+// Blocks that are alive, indexed by their id (0 if the id is free). The allocation done by 'kalloc_init' is not traced,
+// since the benchmark does the same one when it creates a heap.
+static void* trace_blocks[TRACE_MAX_BLOCKS];
+static s32 trace_enabled = 0;
+
+static void trace_write_string(const s8* str) {
+	while (*str) {
+		io_byte_out(TRACE_PORT, *str++);
+	}
+}
+
+static void trace_write_u32(u32 value) {
+	s8 buffer[11];
+	s32 i = sizeof(buffer) - 1;
+	buffer[i] = 0;
+	do {
+		buffer[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	trace_write_string(&buffer[i]);
+}
+
+// Returns the id of a block (or the first free id, if 'ptr' is 0).
+// Block ids are looked up linearly. This is slow, but the trace is only recorded when debugging.
+static u32 trace_get_id(void* ptr) {
+	for (u32 i = 0; i < TRACE_MAX_BLOCKS; ++i) {
+		if (trace_blocks[i] == ptr) {
+			return i;
+		}
+	}
+	assert(ptr != 0, "kalloc: there are more than %u blocks alive, which can't be traced.", TRACE_MAX_BLOCKS);
+	assert(0, "kalloc: block 0x%x is not in the trace.", ptr);
+	return 0;
+}
+
+// a <id> <size> [alignment]
+static void trace_alloc(void* ptr, u32 size, u32 alignment) {
+	if (!trace_enabled) {
+		return;
+	}
+	u32 id = trace_get_id(0);
+	trace_blocks[id] = ptr;
+	trace_write_string("a ");
+	trace_write_u32(id);
+	trace_write_string(" ");
+	trace_write_u32(size);
+	if (alignment) {
+		trace_write_string(" ");
+		trace_write_u32(alignment);
+	}
+	trace_write_string("\n");
+}
+
+// f <id>
+static void trace_free(void* ptr) {
+	if (!trace_enabled) {
+		return;
+	}
+	u32 id = trace_get_id(ptr);
+	trace_blocks[id] = 0;
+	trace_write_string("f ");
+	trace_write_u32(id);
+	trace_write_string("\n");
+}
+
+// r <id> <size>. The id stays the same, even if the block moves.
+static void trace_realloc(void* old_ptr, void* new_ptr, u32 new_size) {
+	if (!trace_enabled) {
+		return;
+	}
+	if (!old_ptr) {
+		trace_alloc(new_ptr, new_size, 0);
+		return;
+	}
+	u32 id = trace_get_id(old_ptr);
+	trace_blocks[id] = new_ptr;
+	trace_write_string("r ");
+	trace_write_u32(id);
+	trace_write_string(" ");
+	trace_write_u32(new_size);
+	trace_write_string("\n");
+}
+#define TRACE_ALLOC(ptr, size, alignment) trace_alloc((ptr), (size), (alignment))
+#define TRACE_FREE(ptr) trace_free(ptr)
+#define TRACE_REALLOC(old_ptr, new_ptr, new_size) trace_realloc((old_ptr), (new_ptr), (new_size))
+#else
+#define TRACE_ALLOC(ptr, size, alignment)
+#define TRACE_FREE(ptr)
+#define TRACE_REALLOC(old_ptr, new_ptr, new_size)
+#endif
+
 void kalloc_init(u32 initial_pages) {
 	kalloc_heap_create(&heap, KERNEL_HEAP_ADDRESS, initial_pages);
 	// Allocate 1 byte so heap is not empty
 	// needed if we start by allocating aligned space
 	kalloc_alloc(1);
+#ifdef KALLOC_RECORD_TRACE
+	trace_write_string("# Kernel heap trace, recorded with KALLOC_RECORD_TRACE\n");
+	trace_enabled = 1;
+#endif
 	//kalloc_test(&heap); while(1);
+	//kalloc_test_stress(&heap, 2000000); while(1);
 }
 
 void* kalloc_alloc(u32 size) {
-	return kalloc_heap_alloc(&heap, size, 0x0);
+	void* ptr = TAG_BLOCK(kalloc_heap_alloc(&heap, size, 0x0));
+	TRACE_ALLOC(ptr, size, 0);
+	return ptr;
 }
 
 void kalloc_free(void* ptr) {
+	TRACE_FREE(ptr);
 	kalloc_heap_free(&heap, ptr);
 }
 
 void* kalloc_alloc_aligned(u32 size, u32 alignment) {
-	return kalloc_heap_alloc(&heap, size, alignment);
+	void* ptr = TAG_BLOCK(kalloc_heap_alloc(&heap, size, alignment));
+	TRACE_ALLOC(ptr, size, alignment);
+	return ptr;
 }
 
-void* kalloc_realloc(void* ptr, u32 old_size, u32 new_size) {
-	if (new_size <= old_size) {
-		return ptr;
-	}
-	void* mem = kalloc_heap_alloc(&heap, new_size, 0x0);
-	memcpy(mem, ptr, old_size);
-	kalloc_free(ptr);
-	return mem;
+void* kalloc_realloc(void* ptr, u32 new_size) {
+	void* new_ptr = TAG_BLOCK(kalloc_heap_realloc(&heap, ptr, new_size));
+	TRACE_REALLOC(ptr, new_ptr, new_size);
+	return new_ptr;
+}
+
+u32 kalloc_usable_size(const void* ptr) {
+	return kalloc_heap_usable_size(&heap, ptr);
+}
+
+void kalloc_get_statistics(Kalloc_Heap_Statistics* statistics) {
+	kalloc_heap_get_statistics(&heap, statistics);
+}
+
+void kalloc_print_statistics() {
+	kalloc_heap_print_statistics(&heap);
+}
+
+#ifdef KALLOC_TRACK_CALLERS
+u32 kalloc_print_callers(u32 owner) {
+	return kalloc_heap_print_callers(&heap, owner);
 }
+#endif
 
 void kalloc_print() {
 	kalloc_print(&heap);
@@ -1,6 +1,7 @@
 #ifndef RAW_OS_ALLOC_KALLOC_H
 #define RAW_OS_ALLOC_KALLOC_H
 #include "../common.h"
+#include "kalloc_heap.h"
 // Wrapper over kalloc_heap
 #define KERNEL_HEAP_ADDRESS 0x00500000
 
@@ -8,6 +9,12 @@ void kalloc_init(u32 initial_pages);
 void* kalloc_alloc(u32 size);
 void* kalloc_alloc_aligned(u32 size, u32 alignment);
 void kalloc_free(void* ptr);
-void* kalloc_realloc(void* ptr, u32 old_size, u32 new_size);
+void* kalloc_realloc(void* ptr, u32 new_size);
+u32 kalloc_usable_size(const void* ptr);
 void kalloc_print();
+void kalloc_get_statistics(Kalloc_Heap_Statistics* statistics);
+void kalloc_print_statistics();
+#ifdef KALLOC_TRACK_CALLERS
+u32 kalloc_print_callers(u32 owner);
+#endif
 #endif
\ No newline at end of file
@@ -17,48 +17,12 @@ static s32 compare_hole(u32 h1_size, void* h1_addr, u32 h2_size, void* h2_addr)
 	return 0;
 }
 
-void kalloc_avl_init(Kalloc_AVL* avl, void* data, u32 data_size) {
-	assert(data_size >= sizeof(Kalloc_AVL_Node), "kalloc_avl: can't initiate. data_size must be greater or equal to the size of the node");
-	u32 num_nodes = data_size / sizeof(Kalloc_AVL_Node);
-	for (u32 i = 0; i < num_nodes; ++i) {
-		Kalloc_AVL_Node* previous = (i > 0) ? (Kalloc_AVL_Node*)data + i - 1 : 0;
-		Kalloc_AVL_Node* current = (Kalloc_AVL_Node*)data + i;
-		Kalloc_AVL_Node* next = (i != num_nodes - 1) ? (Kalloc_AVL_Node*)data + i + 1: 0;
-		current->left = previous;
-		current->right = next;
-		current->hole_size = 0;
-		current->hole_addr = 0;
-		current->height = 0;
-	}
-
+void kalloc_avl_init(Kalloc_AVL* avl) {
 	avl->root = 0;
-	avl->free = (Kalloc_AVL_Node*)data;
-}
-
-static Kalloc_AVL_Node* get_free_node(Kalloc_AVL* avl) {
-	Kalloc_AVL_Node* target = avl->free;
-	assert(target != 0, "kalloc_avl: no free node available");
-	if (avl->free->right) {
-		assert(avl->free->right->left == target, "kalloc_avl: next node is not pointing to current");
-		avl->free->right->left = 0;
-	}
-	avl->free = avl->free->right;
-	return target;
-}
-
-static void put_free_node(Kalloc_AVL* avl, Kalloc_AVL_Node* node) {
-	Kalloc_AVL_Node* previous_root = avl->free;
-	avl->free = node;
-	avl->free->left = 0;
-	avl->free->right = previous_root;
-	if (previous_root) {
-		assert(previous_root->left == 0, "kalloc_avl: previous root free node had something on the left");
-		previous_root->left = avl->free;
-	}
 }
 
 static int hole_has_alignment_space(const Kalloc_AVL_Node* node, u32 wanted_size, u32 alignment) {
-	u32 aligned_addr = (u32)node->hole_addr;
+	u32 aligned_addr = (u32)node;
 	if (alignment != 0) {
 		if (aligned_addr & (alignment - 1)) {
 			aligned_addr &= ~(alignment - 1);
@@ -66,7 +30,7 @@ static int hole_has_alignment_space(const Kalloc_AVL_Node* node, u32 wanted_size
 		}
 	}
 
-	return node->hole_size >= wanted_size + (aligned_addr - (u32)node->hole_addr);
+	return node->hole_size >= wanted_size + (aligned_addr - (u32)node);
 }
 
 static void* avl_find_hole_internal(Kalloc_AVL_Node* node, u32 hole_size, u32 alignment) {
@@ -82,7 +46,7 @@ static void* avl_find_hole_internal(Kalloc_AVL_Node* node, u32 hole_size, u32 al
 		// This will ensure that we will always choose the smallest hole address
 		// Which is useful to prevent fragmentation and allow heap shrinking
 		void* hole_addr = avl_find_hole_internal(node->left, hole_size, alignment);
-		return hole_addr ? hole_addr : node->hole_addr;
+		return hole_addr ? hole_addr : node;
 	}
 }
 
@@ -169,28 +133,23 @@ static s32 get_balance_factor(const Kalloc_AVL_Node* node) {
 	return right_height - left_height;
 }
 
-static Kalloc_AVL_Node* insert_internal(Kalloc_AVL* avl, Kalloc_AVL_Node* avl_node, u32 hole_size, void* hole_addr, s32* subtree_height_changed, s32* error) {
+static Kalloc_AVL_Node* insert_internal(Kalloc_AVL_Node* avl_node, u32 hole_size, void* hole_addr, s32* subtree_height_changed) {
 	if (!avl_node) {
-		avl_node = get_free_node(avl);
-		if (!avl_node) {
-			*error = 1;
-			return 0;
-		} else {
-			avl_node->hole_addr = hole_addr;
-			avl_node->hole_size = hole_size;
-			avl_node->left = 0;
-			avl_node->right = 0;
-			avl_node->height = 1;
-			*subtree_height_changed = 1;
-			return avl_node;
-		}
+		// The node lives inside the hole itself
+		avl_node = (Kalloc_AVL_Node*)hole_addr;
+		avl_node->hole_size = hole_size;
+		avl_node->left = 0;
+		avl_node->right = 0;
+		avl_node->height = 1;
+		*subtree_height_changed = 1;
+		return avl_node;
 	}
 
 	Kalloc_AVL_Node* new_root = avl_node;
-	s32 comparison = compare_hole(hole_size, hole_addr, avl_node->hole_size, avl_node->hole_addr);
+	s32 comparison = compare_hole(hole_size, hole_addr, avl_node->hole_size, avl_node);
 	assert(comparison != 0, "heap_avl: Trying to insert same element to AVL.");
 	if (comparison > 0) {
-		avl_node->right = insert_internal(avl, avl_node->right, hole_size, hole_addr, subtree_height_changed, error);
+		avl_node->right = insert_internal(avl_node->right, hole_size, hole_addr, subtree_height_changed);
 		if (*subtree_height_changed) {
 			s32 balance_factor = get_balance_factor(avl_node);
 			assert(balance_factor >= 0 && balance_factor <= 2, "heap_avl: balance_factor must be between 0 and 2, but got %u", balance_factor);
@@ -210,7 +169,7 @@ static Kalloc_AVL_Node* insert_internal(Kalloc_AVL* avl, Kalloc_AVL_Node* avl_no
 			}
 		}
 	} else if (comparison < 0) {
-		avl_node->left = insert_internal(avl, avl_node->left, hole_size, hole_addr, subtree_height_changed, error);
+		avl_node->left = insert_internal(avl_node->left, hole_size, hole_addr, subtree_height_changed);
 		if (*subtree_height_changed) {
 			s32 balance_factor = get_balance_factor(avl_node);
 			assert(balance_factor >= -2 && balance_factor <= 0, "heap_avl: balance_factor must be between -2 and 0, but got %u", balance_factor);
@@ -236,9 +195,10 @@ static Kalloc_AVL_Node* insert_internal(Kalloc_AVL* avl, Kalloc_AVL_Node* avl_no
 
 // Insert a hole to the AVL.
 s32 kalloc_avl_insert(Kalloc_AVL* avl, u32 hole_size, void* hole_addr) {
-	s32 subtree_height_changed, error = 0;
-	avl->root = insert_internal(avl, avl->root, hole_size, hole_addr, &subtree_height_changed, &error);
-	return error;
+	assert(hole_size >= KALLOC_AVL_MIN_HOLE_SIZE, "heap_avl: hole is too small (%u bytes)", hole_size);
+	s32 subtree_height_changed;
+	avl->root = insert_internal(avl->root, hole_size, hole_addr, &subtree_height_changed);
+	return 0;
 }
 
 static Kalloc_AVL_Node* find_predecessor(Kalloc_AVL_Node* node) {
@@ -249,104 +209,113 @@ static Kalloc_AVL_Node* find_predecessor(Kalloc_AVL_Node* node) {
 	return current;
 }
 
-static Kalloc_AVL_Node* remove_internal(Kalloc_AVL* avl, Kalloc_AVL_Node* avl_node, u32 hole_size, void* hole_addr, s32* subtree_height_changed, s32* not_found) {
-	if (!avl_node) {
-		*not_found = 1;
-		return 0;
-	}
-
+// Rebalances a node after a removal from its right subtree.
+static Kalloc_AVL_Node* rebalance_after_right_removal(Kalloc_AVL_Node* avl_node, s32* subtree_height_changed) {
 	Kalloc_AVL_Node* new_root = avl_node;
-	s32 comparison = compare_hole(hole_size, hole_addr, avl_node->hole_size, avl_node->hole_addr);
-
-	if (comparison == 0) {
-		if (!avl_node->left && !avl_node->right) {
-			put_free_node(avl, avl_node);
+	if (*subtree_height_changed) {
+		s32 balance_factor = get_balance_factor(avl_node);
+		assert(balance_factor >= -2 && balance_factor <= 0, "heap_avl: balance_factor must be between -2 and 0, but got %u", balance_factor);
+		if (balance_factor == 0) {
 			*subtree_height_changed = 1;
-			return 0;
-		} else if (!avl_node->left) {
-			avl_node->hole_size = avl_node->right->hole_size;
-			avl_node->hole_addr = avl_node->right->hole_addr;
-			put_free_node(avl, avl_node->right);
-			avl_node->right = 0;
 			--avl_node->height;
-			*subtree_height_changed = 1;
-			return avl_node;
-		} else if (!avl_node->right) {
-			avl_node->hole_size = avl_node->left->hole_size;
-			avl_node->hole_addr = avl_node->left->hole_addr;
-			put_free_node(avl, avl_node->left);
-			avl_node->left = 0;
-			--avl_node->height;
-			*subtree_height_changed = 1;
-			return avl_node;
-		} else {
-			Kalloc_AVL_Node* predecessor = find_predecessor(avl_node);
-			comparison = compare_hole(predecessor->hole_size, predecessor->hole_addr, avl_node->hole_size, avl_node->hole_addr);
-			hole_size = predecessor->hole_size;
-			hole_addr = predecessor->hole_addr;
-			avl_node->hole_size = predecessor->hole_size;
-			avl_node->hole_addr = predecessor->hole_addr;
+		} else if (balance_factor == -1) {
+			*subtree_height_changed = 0;
+		} else if (balance_factor == -2) {
+			s32 left_child_balance_factor = get_balance_factor(avl_node->left);
+			if (left_child_balance_factor == 1) {
+				new_root = double_rotate_right(avl_node);
+			} else {
+				new_root = rotate_right(avl_node);
+			}
+
+			if (get_balance_factor(new_root) == 1) {
+				*subtree_height_changed = 0;
+			} else {
+				*subtree_height_changed = 1;
+			}
 		}
 	}
-	
-	if (comparison > 0) {
-		avl_node->right = remove_internal(avl, avl_node->right, hole_size, hole_addr, subtree_height_changed, not_found);
-		if (*subtree_height_changed) {
-			s32 balance_factor = get_balance_factor(avl_node);
-			assert(balance_factor >= -2 && balance_factor <= 0, "heap_avl: balance_factor must be between -2 and 0, but got %u", balance_factor);
-			if (balance_factor == 0) {
-				*subtree_height_changed = 1;
-				--avl_node->height;
-			} else if (balance_factor == -1) {
-				*subtree_height_changed = 0;
-			} else if (balance_factor == -2) {
-				s32 left_child_balance_factor = get_balance_factor(avl_node->left);
-				if (left_child_balance_factor == 1) {
-					new_root = double_rotate_right(avl_node);
-				} else {
-					new_root = rotate_right(avl_node);
-				}
+	return new_root;
+}
 
-				if (get_balance_factor(new_root) == 1) {
-					*subtree_height_changed = 0;
-				} else {
-					*subtree_height_changed = 1;
-				}
+// Rebalances a node after a removal from its left subtree.
+static Kalloc_AVL_Node* rebalance_after_left_removal(Kalloc_AVL_Node* avl_node, s32* subtree_height_changed) {
+	Kalloc_AVL_Node* new_root = avl_node;
+	if (*subtree_height_changed) {
+		s32 balance_factor = get_balance_factor(avl_node);
+		assert(balance_factor >= 0 && balance_factor <= 2, "heap_avl: balance_factor must be between 0 and 2, but got %u", balance_factor);
+		if (balance_factor == 0) {
+			*subtree_height_changed = 1;
+			--avl_node->height;
+		} else if (balance_factor == 1) {
+			*subtree_height_changed = 0;
+		} else if (balance_factor == 2) {
+			s32 right_child_balance_factor = get_balance_factor(avl_node->right);
+			if (right_child_balance_factor == -1) {
+				new_root = double_rotate_left(avl_node);
+			} else {
+				new_root = rotate_left(avl_node);
 			}
-		}
-	} else {
-		avl_node->left = remove_internal(avl, avl_node->left, hole_size, hole_addr, subtree_height_changed, not_found);
-		if (*subtree_height_changed) {
-			s32 balance_factor = get_balance_factor(avl_node);
-			assert(balance_factor >= 0 && balance_factor <= 2, "heap_avl: balance_factor must be between 0 and 2, but got %u", balance_factor);
-			if (balance_factor == 0) {
-				*subtree_height_changed = 1;
-				--avl_node->height;
-			} else if (balance_factor == 1) {
+			
+			if (get_balance_factor(new_root) == -1) {
 				*subtree_height_changed = 0;
-			} else if (balance_factor == 2) {
-				s32 right_child_balance_factor = get_balance_factor(avl_node->right);
-				if (right_child_balance_factor == -1) {
-					new_root = double_rotate_left(avl_node);
-				} else {
-					new_root = rotate_left(avl_node);
-				}
-				
-				if (get_balance_factor(new_root) == -1) {
-					*subtree_height_changed = 0;
-				} else {
-					*subtree_height_changed = 1;
-				}
+			} else {
+				*subtree_height_changed = 1;
 			}
 		}
 	}
-
 	return new_root;
 }
 
+// Since nodes live inside the holes, a node can't receive the contents of another node when it is removed.
+// Instead, nodes are relinked: a node with two children is replaced by its predecessor.
+static Kalloc_AVL_Node* remove_internal(Kalloc_AVL_Node* avl_node, u32 hole_size, void* hole_addr, s32* subtree_height_changed, s32* not_found) {
+	if (!avl_node) {
+		*not_found = 1;
+		return 0;
+	}
+
+	s32 comparison = compare_hole(hole_size, hole_addr, avl_node->hole_size, avl_node);
+
+	if (comparison == 0) {
+		if (!avl_node->left || !avl_node->right) {
+			*subtree_height_changed = 1;
+			return avl_node->left ? avl_node->left : avl_node->right;
+		}
+
+		Kalloc_AVL_Node* predecessor = find_predecessor(avl_node);
+		predecessor->left = remove_internal(avl_node->left, predecessor->hole_size, predecessor, subtree_height_changed, not_found);
+		predecessor->right = avl_node->right;
+		predecessor->height = avl_node->height;
+		return rebalance_after_left_removal(predecessor, subtree_height_changed);
+	} else if (comparison > 0) {
+		avl_node->right = remove_internal(avl_node->right, hole_size, hole_addr, subtree_height_changed, not_found);
+		return rebalance_after_right_removal(avl_node, subtree_height_changed);
+	} else {
+		avl_node->left = remove_internal(avl_node->left, hole_size, hole_addr, subtree_height_changed, not_found);
+		return rebalance_after_left_removal(avl_node, subtree_height_changed);
+	}
+}
+
 // Remove a hole from the AVL.
 s32 kalloc_avl_remove(Kalloc_AVL* avl, u32 hole_size, void* hole_addr) {
 	s32 subtree_height_changed, not_found = 0;
-	avl->root = remove_internal(avl, avl->root, hole_size, hole_addr, &subtree_height_changed, &not_found);
+	avl->root = remove_internal(avl->root, hole_size, hole_addr, &subtree_height_changed, &not_found);
 	return not_found;
+}
+
+// The holes are sorted by size, so the largest hole is the rightmost node. Returns 0 if there are no holes.
+u32 kalloc_avl_get_largest_hole_size(const Kalloc_AVL* avl) {
+	const Kalloc_AVL_Node* node = avl->root;
+	if (!node) {
+		return 0;
+	}
+	while (node->right) {
+		node = node->right;
+	}
+	return node->hole_size;
+}
+
+s32 kalloc_avl_get_height(const Kalloc_AVL* avl) {
+	return avl->root ? avl->root->height : 0;
 }
\ No newline at end of file
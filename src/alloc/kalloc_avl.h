@@ -2,22 +2,27 @@
 #define RAW_OS_ALLOC_KALLOC_AVL_H
 #include "../common.h"
 
+// The nodes are stored inside the holes themselves, so the AVL never runs out of nodes.
+// The address of a node is the address of its hole.
 typedef struct Kalloc_AVL_Node {
 	struct Kalloc_AVL_Node* left;
 	struct Kalloc_AVL_Node* right;
 	s32 height;						// The height of this node, in the AVL
 	u32 hole_size;					// The size of the hole, in bytes
-	void* hole_addr;				// The address of the hole, pointing to the Heap Header
 } Kalloc_AVL_Node;
 
+// Holes must have at least this many bytes to hold their node
+#define KALLOC_AVL_MIN_HOLE_SIZE sizeof(Kalloc_AVL_Node)
+
 typedef struct {
-	Kalloc_AVL_Node* free;
 	Kalloc_AVL_Node* root;
 } Kalloc_AVL;
 
-void kalloc_avl_init(Kalloc_AVL* avl, void* data, u32 data_size);
+void kalloc_avl_init(Kalloc_AVL* avl);
 void* kalloc_avl_find_hole(const Kalloc_AVL* avl, u32 hole_size, u32 alignment);
 s32 kalloc_avl_insert(Kalloc_AVL* avl, u32 hole_size, void* hole_addr);
 s32 kalloc_avl_remove(Kalloc_AVL* avl, u32 hole_size, void* hole_addr);
+u32 kalloc_avl_get_largest_hole_size(const Kalloc_AVL* avl);
+s32 kalloc_avl_get_height(const Kalloc_AVL* avl);
 
 #endif
\ No newline at end of file
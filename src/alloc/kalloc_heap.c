@@ -3,17 +3,32 @@
 #include "../util/printf.h"
 #include "../paging.h"
 
-#define COMPLEX_HEAP_ENABLED
 #define HEAP_HEADER_MAGIC 0xABCD
 #define HEAP_FOOTER_MAGIC 0xEF01
-#define NUM_PAGES_RESERVED_FOR_AVL 16
-#define HEAP_MAX_SIZE 64 * 1024 * 1024
+// The heap can grow through the kernel address space until it reaches the frame reference counts
+#define HEAP_MAX_ADDRESS FRAME_REFERENCE_COUNTS_ADDRESS
+// The heap grows by a power of two number of pages, and never by less than this
+#define HEAP_MIN_GROWTH_PAGES 4
+// When the last hole of the heap reaches this size, the heap is shrunk so only HEAP_TRIM_KEEP_SIZE bytes of it are kept
+#define HEAP_TRIM_THRESHOLD (64 * PAGE_SIZE)
+#define HEAP_TRIM_KEEP_SIZE (16 * PAGE_SIZE)
 #define PAGE_SIZE 4096
+// Holes are at least this big, so the hole index can keep its data inside them
+#ifdef TLSF_HEAP_ENABLED
+#define HEAP_MIN_BLOCK_SIZE KALLOC_TLSF_MIN_HOLE_SIZE
+#else
+#define HEAP_MIN_BLOCK_SIZE KALLOC_AVL_MIN_HOLE_SIZE
+#endif
 
 typedef struct {
 	u16 magic;
 	u32 size;
 	s32 used;
+#ifdef KALLOC_TRACK_CALLERS
+	u32 caller;					// Address of the code that allocated the block
+	u32 owner;					// Pid of the process that allocated the block (0 if it was the kernel itself)
+	u32 timestamp;				// Uptime, in seconds, when the block was allocated
+#endif
 } Kalloc_Heap_Header;
 
 typedef struct {
@@ -22,20 +37,68 @@ typedef struct {
 } Kalloc_Heap_Footer;
 
 #ifdef COMPLEX_HEAP_ENABLED
+// The holes are indexed by size, either by a TLSF (constant time) or by an AVL tree (best fit, logarithmic time).
+static void* find_hole(const Kalloc_Heap* heap, u32 size, u32 alignment) {
+#ifdef TLSF_HEAP_ENABLED
+	return kalloc_tlsf_find_hole(&heap->tlsf, size, alignment);
+#else
+	return kalloc_avl_find_hole(&heap->avl, size, alignment);
+#endif
+}
+
+static void insert_hole(Kalloc_Heap* heap, u32 size, void* user_space) {
+#ifdef TLSF_HEAP_ENABLED
+	kalloc_tlsf_insert(&heap->tlsf, size, user_space);
+#else
+	kalloc_avl_insert(&heap->avl, size, user_space);
+#endif
+	++heap->statistics.holes;
+}
+
+static void remove_hole(Kalloc_Heap* heap, u32 size, void* user_space) {
+#ifdef TLSF_HEAP_ENABLED
+	kalloc_tlsf_remove(&heap->tlsf, size, user_space);
+#else
+	kalloc_avl_remove(&heap->avl, size, user_space);
+#endif
+	--heap->statistics.holes;
+}
+
+static Kalloc_Heap_Header* get_header(const void* user_space) {
+	return (Kalloc_Heap_Header*)((u8*)user_space - sizeof(Kalloc_Heap_Header));
+}
+
+static u32 get_size_class(u32 size) {
+	return MIN(31 - __builtin_clz(size), KALLOC_HEAP_SIZE_CLASSES - 1);
+}
+
+// Updates the statistics when a block of 'size' bytes starts (count = 1) or stops (count = -1) being used
+static void account_block(Kalloc_Heap* heap, u32 size, s32 count) {
+	Kalloc_Heap_Statistics* statistics = &heap->statistics;
+	statistics->used_blocks += count;
+	statistics->used_bytes += count * (s32)size;
+	statistics->used_blocks_by_size_class[get_size_class(size)] += count;
+	statistics->peak_used_bytes = MAX(statistics->peak_used_bytes, statistics->used_bytes);
+}
+
 void kalloc_heap_create(Kalloc_Heap* heap, u32 initial_addr, u32 initial_pages) {
 	assert(initial_addr % 0x1000 == 0, "kalloc: initial address must be aligned to 0x1000, but got 0x%u!", initial_addr);
 	assert(initial_pages * PAGE_SIZE >= sizeof(Kalloc_Heap_Footer) + sizeof(Kalloc_Heap_Header),
 		"kalloc: insufficient number of initial pages (%u).", initial_pages);
 
-	for (u32 i = 0; i < NUM_PAGES_RESERVED_FOR_AVL + initial_pages; ++i) {
+	for (u32 i = 0; i < initial_pages; ++i) {
 		paging_create_kernel_page_with_any_frame(initial_addr / PAGE_SIZE + i);
 	}
 
-	heap->avl_initial_addr = initial_addr;
-	heap->initial_addr = initial_addr + NUM_PAGES_RESERVED_FOR_AVL * PAGE_SIZE;
+	heap->initial_addr = initial_addr;
 	heap->size = initial_pages * PAGE_SIZE;
+	memset(&heap->statistics, 0, sizeof(Kalloc_Heap_Statistics));
 
-	kalloc_avl_init(&heap->avl, (void*)heap->avl_initial_addr, NUM_PAGES_RESERVED_FOR_AVL * PAGE_SIZE);
+#ifdef TLSF_HEAP_ENABLED
+	kalloc_tlsf_init(&heap->tlsf);
+#else
+	kalloc_avl_init(&heap->avl);
+#endif
 
 	Kalloc_Heap_Header* first_header = (Kalloc_Heap_Header*)heap->initial_addr;
 	Kalloc_Heap_Footer* first_footer = (Kalloc_Heap_Footer*)((u8*)heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer));
@@ -46,7 +109,7 @@ void kalloc_heap_create(Kalloc_Heap* heap, u32 initial_addr, u32 initial_pages)
 	first_footer->header = first_header;
 	first_footer->magic = HEAP_FOOTER_MAGIC;
 	
-	kalloc_avl_insert(&heap->avl, first_header->size, (u8*)first_header + sizeof(Kalloc_Heap_Header));
+	insert_hole(heap, first_header->size, (u8*)first_header + sizeof(Kalloc_Heap_Header));
 }
 
 static void* get_aligned_address(void* address, u32 alignment) {
@@ -61,15 +124,81 @@ static void* get_aligned_address(void* address, u32 alignment) {
 	return (void*)aligned_addr;
 }
 
-void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
-	void* user_space = kalloc_avl_find_hole(&heap->avl, size, alignment);
+// Grows the heap by at least 'min_size' bytes (plus the block tags). The growth is rounded up to a power of two
+// number of pages, and all pages are mapped in one go.
+static void expand_heap(Kalloc_Heap* heap, u32 min_size) {
+	u32 needed_pages = (min_size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer) + PAGE_SIZE - 1) / PAGE_SIZE;
+	u32 max_pages = (HEAP_MAX_ADDRESS - (heap->initial_addr + heap->size)) / PAGE_SIZE;
+	u32 pages = HEAP_MIN_GROWTH_PAGES;
+	while (pages < needed_pages) {
+		pages *= 2;
+	}
+	pages = MIN(pages, max_pages);
+	assert(pages >= needed_pages, "kalloc: kernel heap is full (%u bytes).", heap->size);
+
+	//printf("Expanding heap... Going from %u pages to %u pages.\n", heap->size / PAGE_SIZE, heap->size / PAGE_SIZE + pages);
+	for (u32 i = 0; i < pages; ++i) {
+		paging_create_kernel_page_with_any_frame((heap->initial_addr + heap->size) / PAGE_SIZE + i);
+	}
+	u32 growth = pages * PAGE_SIZE;
+	++heap->statistics.expansions;
+
+	Kalloc_Heap_Footer* last_footer = (Kalloc_Heap_Footer*)((u8*)heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer));
+	Kalloc_Heap_Header* last_header = last_footer->header;
+	heap->size += growth;
+
+	if (last_header->used) {
+		Kalloc_Heap_Header* new_hole_header = (Kalloc_Heap_Header*)((u8*)last_footer + sizeof(Kalloc_Heap_Footer));
+		Kalloc_Heap_Footer* new_hole_footer = (Kalloc_Heap_Footer*)((u8*)new_hole_header + growth - sizeof(Kalloc_Heap_Footer));
+		new_hole_header->magic = HEAP_HEADER_MAGIC;
+		new_hole_header->size = growth - sizeof(Kalloc_Heap_Header) - sizeof(Kalloc_Heap_Footer);
+		new_hole_header->used = 0;
+		new_hole_footer->magic = HEAP_FOOTER_MAGIC;
+		new_hole_footer->header = new_hole_header;
+
+		insert_hole(heap, new_hole_header->size, (u8*)new_hole_header + sizeof(Kalloc_Heap_Header));
+	} else {
+		Kalloc_Heap_Footer* new_footer = (Kalloc_Heap_Footer*)((u8*)heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer));
+		new_footer->magic = HEAP_FOOTER_MAGIC;
+		new_footer->header = last_header;
+
+		remove_hole(heap, last_header->size, (u8*)last_header + sizeof(Kalloc_Heap_Header));
+		last_header->size += growth;
+		insert_hole(heap, last_header->size, (u8*)last_header + sizeof(Kalloc_Heap_Header));
+	}
+}
+
+// Shrinks the heap when its last hole is too big, returning the frames of the pages at the end of the heap.
+// The hole must not be in the hole index. Returns the new footer of the hole.
+static Kalloc_Heap_Footer* trim_heap(Kalloc_Heap* heap, Kalloc_Heap_Header* last_header) {
+	u32 heap_end = heap->initial_addr + heap->size;
+	u32 new_heap_end = (u32)last_header + sizeof(Kalloc_Heap_Header) + HEAP_TRIM_KEEP_SIZE + sizeof(Kalloc_Heap_Footer);
+	new_heap_end = (new_heap_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	for (u32 page_num = new_heap_end / PAGE_SIZE; page_num < heap_end / PAGE_SIZE; ++page_num) {
+		paging_remove_kernel_page(page_num);
+	}
+	paging_tlb_flush();
+	++heap->statistics.trims;
+
+	heap->size = new_heap_end - heap->initial_addr;
+	Kalloc_Heap_Footer* last_footer = (Kalloc_Heap_Footer*)(new_heap_end - sizeof(Kalloc_Heap_Footer));
+	last_header->size = (u8*)last_footer - ((u8*)last_header + sizeof(Kalloc_Heap_Header));
+	last_footer->magic = HEAP_FOOTER_MAGIC;
+	last_footer->header = last_header;
+	return last_footer;
+}
+
+static void* alloc_block(Kalloc_Heap* heap, u32 size, u32 alignment) {
+	size = MAX(size, HEAP_MIN_BLOCK_SIZE);
+	void* user_space = find_hole(heap, size, alignment);
 
 	if (user_space) {
 		Kalloc_Heap_Header* target_hole_header = (Kalloc_Heap_Header*)((u8*)user_space - sizeof(Kalloc_Heap_Header));
 		// We found a hole
 		assert(target_hole_header->used == 0,
 			"kalloc: found hole in inconsistent state (expected used=0, but got used=%u).", target_hole_header->used);
-		kalloc_avl_remove(&heap->avl, target_hole_header->size, user_space);
+		remove_hole(heap, target_hole_header->size, user_space);
 		u32 hole_size = target_hole_header->size;
 		
 		void* aligned_user_space = get_aligned_address(user_space, alignment);
@@ -93,9 +222,12 @@ void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
 			Kalloc_Heap_Footer* new_previous_footer = (Kalloc_Heap_Footer*)((u8*)target_aligned_hole_header - sizeof(Kalloc_Heap_Footer));
 			assert((void*)new_previous_footer > (void*)previous_footer,
 				"kalloc: new footer address must be greater than previous footer address");
+			// Holes are never adjacent, so the previous one is a block. Its size changes, so it is accounted again.
+			account_block(heap, previous_header->size, -1);
 			previous_header->size += (u8*)new_previous_footer - (u8*)previous_footer;
 			new_previous_footer->header = previous_header;
 			new_previous_footer->magic = HEAP_FOOTER_MAGIC;
+			account_block(heap, previous_header->size, 1);
 
 			target_hole_footer->header = target_aligned_hole_header;
 
@@ -112,7 +244,7 @@ void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
 		user_space = aligned_user_space;
 
 		// If we still have enough free space in the hole, we generate a new hole.
-		if (target_hole_header->size > size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer)) {
+		if (target_hole_header->size >= size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer) + HEAP_MIN_BLOCK_SIZE) {
 			Kalloc_Heap_Header* new_block_header = target_hole_header;
 			Kalloc_Heap_Footer* new_block_footer = (Kalloc_Heap_Footer*)((u8*)new_block_header + sizeof(Kalloc_Heap_Header) + size);
 			Kalloc_Heap_Header* new_hole_header = (Kalloc_Heap_Header*)((u8*)new_block_footer + sizeof(Kalloc_Heap_Footer));
@@ -126,45 +258,21 @@ void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
 			new_hole_header->size = hole_size - size - sizeof(Kalloc_Heap_Header) - sizeof(Kalloc_Heap_Footer);
 			new_hole_header->used = 0;
 			new_hole_footer->header = new_hole_header;
-			kalloc_avl_insert(&heap->avl, new_hole_header->size, (u8*)new_hole_header + sizeof(Kalloc_Heap_Header));
+			insert_hole(heap, new_hole_header->size, (u8*)new_hole_header + sizeof(Kalloc_Heap_Header));
 			return user_space;
 		} else {
 			target_hole_header->used = 1;
 			return user_space;
 		}
 	} else {
-		// If we were not able to find a fitting hole in the AVL, we need to expand the heap.
-		//printf("Expanding heap... Going from %u pages to %u pages.\n", heap->size / PAGE_SIZE, heap->size / PAGE_SIZE + 1);
-		paging_create_kernel_page_with_any_frame((heap->initial_addr + heap->size) / PAGE_SIZE);
-
-		Kalloc_Heap_Footer* last_footer = (Kalloc_Heap_Footer*)((u8*)heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer));
-		Kalloc_Heap_Header* last_header = last_footer->header;
-		heap->size += PAGE_SIZE;
-
-		if (last_header->used) {
-			Kalloc_Heap_Header* new_hole_header = (Kalloc_Heap_Header*)((u8*)last_footer + sizeof(Kalloc_Heap_Footer));
-			Kalloc_Heap_Footer* new_hole_footer = (Kalloc_Heap_Footer*)((u8*)new_hole_header + PAGE_SIZE - sizeof(Kalloc_Heap_Footer));
-			new_hole_header->magic = HEAP_HEADER_MAGIC;
-			new_hole_header->size = PAGE_SIZE - sizeof(Kalloc_Heap_Header) - sizeof(Kalloc_Heap_Footer);
-			new_hole_header->used = 0;
-			new_hole_footer->magic = HEAP_FOOTER_MAGIC;
-			new_hole_footer->header = new_hole_header;
-
-			kalloc_avl_insert(&heap->avl, new_hole_header->size, (u8*)new_hole_header + sizeof(Kalloc_Heap_Header));
-		} else {
-			Kalloc_Heap_Footer* new_footer = (Kalloc_Heap_Footer*)((u8*)heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer));
-			new_footer->magic = HEAP_FOOTER_MAGIC;
-			new_footer->header = last_header;
-
-			kalloc_avl_remove(&heap->avl, last_header->size, (u8*)last_header + sizeof(Kalloc_Heap_Header));
-			last_header->size += PAGE_SIZE;
-			kalloc_avl_insert(&heap->avl, last_header->size, (u8*)last_header + sizeof(Kalloc_Heap_Header));
-		}
-		return kalloc_heap_alloc(heap, size, alignment);
+		// If we were not able to find a fitting hole, we need to expand the heap. Since the hole index might round the
+		// size up, we might need to expand it more than once.
+		expand_heap(heap, size + alignment);
+		return alloc_block(heap, size, alignment);
 	}
 }
 
-void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
+static void free_block(Kalloc_Heap* heap, void* ptr) {
 	Kalloc_Heap_Header* header = (Kalloc_Heap_Header*)((u8*)ptr - sizeof(Kalloc_Heap_Header));
 	Kalloc_Heap_Footer* footer = (Kalloc_Heap_Footer*)((u8*)ptr + header->size);
 	assert(header->used == 1,
@@ -178,7 +286,7 @@ void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
 		// Check whether previous header defines a hole
 		if (!previous_header->used) {
 			// Remove this hole from AVL, because we will merge it with the new hole.
-			kalloc_avl_remove(&heap->avl, previous_header->size, (u8*)previous_header + sizeof(Kalloc_Heap_Header));
+			remove_hole(heap, previous_header->size, (u8*)previous_header + sizeof(Kalloc_Heap_Header));
 			previous_header->size += header->size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer);
 			footer->header = previous_header;
 			header = previous_header;
@@ -193,7 +301,7 @@ void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
 		// Check whether next header defines a hole
 		if (!next_header->used) {
 			// Remove this hole from AVL, because we will merge it with the new hole.
-			kalloc_avl_remove(&heap->avl, next_header->size, (u8*)next_header + sizeof(Kalloc_Heap_Header));
+			remove_hole(heap, next_header->size, (u8*)next_header + sizeof(Kalloc_Heap_Header));
 			
 			header->size += next_header->size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer);
 			next_footer->header = header;
@@ -201,8 +309,107 @@ void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
 		}
 	}
 
+	// If the hole is at the end of the heap and it is too big, give some of its pages back
+	if ((u32)footer == heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer) && header->size >= HEAP_TRIM_THRESHOLD) {
+		footer = trim_heap(heap, header);
+	}
+
 	header->used = 0;
-	kalloc_avl_insert(&heap->avl, header->size, (u8*)header + sizeof(Kalloc_Heap_Header));
+	insert_hole(heap, header->size, (u8*)header + sizeof(Kalloc_Heap_Header));
+}
+
+void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
+	void* ptr = alloc_block(heap, size, alignment);
+#ifdef KALLOC_TRACK_CALLERS
+	// Blocks are not tagged unless the caller does it
+	memset(&get_header(ptr)->caller, 0, 3 * sizeof(u32));
+#endif
+	++heap->statistics.allocations;
+	account_block(heap, get_header(ptr)->size, 1);
+	return ptr;
+}
+
+void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
+	++heap->statistics.frees;
+	account_block(heap, get_header(ptr)->size, -1);
+	free_block(heap, ptr);
+}
+
+// Shrinks a block to 'size' bytes. If the tail of the block is big enough to be a hole, it is freed (and merged with
+// the next hole, if any).
+static void shrink_block(Kalloc_Heap* heap, Kalloc_Heap_Header* header, u32 size) {
+	if (header->size < size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer) + HEAP_MIN_BLOCK_SIZE) {
+		return;
+	}
+
+	Kalloc_Heap_Footer* tail_footer = (Kalloc_Heap_Footer*)((u8*)header + sizeof(Kalloc_Heap_Header) + header->size);
+	Kalloc_Heap_Footer* new_footer = (Kalloc_Heap_Footer*)((u8*)header + sizeof(Kalloc_Heap_Header) + size);
+	Kalloc_Heap_Header* tail_header = (Kalloc_Heap_Header*)((u8*)new_footer + sizeof(Kalloc_Heap_Footer));
+
+	tail_header->magic = HEAP_HEADER_MAGIC;
+	tail_header->size = header->size - size - sizeof(Kalloc_Heap_Header) - sizeof(Kalloc_Heap_Footer);
+	tail_header->used = 1;
+	tail_footer->header = tail_header;
+	header->size = size;
+	new_footer->magic = HEAP_FOOTER_MAGIC;
+	new_footer->header = header;
+
+	free_block(heap, (u8*)tail_header + sizeof(Kalloc_Heap_Header));
+}
+
+// Resizes a block. The block is extended in place when it is followed by a big enough hole, or when it is the last
+// block of the heap (in which case the heap is expanded). Otherwise, the data is moved to a new block.
+void* kalloc_heap_realloc(Kalloc_Heap* heap, void* ptr, u32 new_size) {
+	if (!ptr) {
+		return kalloc_heap_alloc(heap, new_size, 0x0);
+	}
+	new_size = MAX(new_size, HEAP_MIN_BLOCK_SIZE);
+	Kalloc_Heap_Header* header = (Kalloc_Heap_Header*)((u8*)ptr - sizeof(Kalloc_Heap_Header));
+	assert(header->used == 1,
+		"kalloc: found hole in inconsistent state (expected used=1, but got used=%u).", header->used);
+	++heap->statistics.reallocations;
+	account_block(heap, header->size, -1);
+
+	if (header->size < new_size) {
+		Kalloc_Heap_Footer* footer = (Kalloc_Heap_Footer*)((u8*)ptr + header->size);
+		if ((u32)footer == heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer)) {
+			// This is the last block, so the heap is expanded right after it
+			expand_heap(heap, new_size - header->size);
+		}
+
+		Kalloc_Heap_Header* next_header = (Kalloc_Heap_Header*)((u8*)footer + sizeof(Kalloc_Heap_Footer));
+		if ((u32)footer == heap->initial_addr + heap->size - sizeof(Kalloc_Heap_Footer) || next_header->used ||
+			header->size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer) + next_header->size < new_size) {
+			void* mem = alloc_block(heap, new_size, 0x0);
+#ifdef KALLOC_TRACK_CALLERS
+			memcpy(&get_header(mem)->caller, &header->caller, 3 * sizeof(u32));
+#endif
+			memcpy(mem, ptr, header->size);
+			free_block(heap, ptr);
+			account_block(heap, get_header(mem)->size, 1);
+			return mem;
+		}
+
+		// Merge the next hole into the block
+		Kalloc_Heap_Footer* next_footer = (Kalloc_Heap_Footer*)((u8*)next_header + sizeof(Kalloc_Heap_Header) + next_header->size);
+		remove_hole(heap, next_header->size, (u8*)next_header + sizeof(Kalloc_Heap_Header));
+		header->size += next_header->size + sizeof(Kalloc_Heap_Header) + sizeof(Kalloc_Heap_Footer);
+		next_footer->header = header;
+	}
+
+	shrink_block(heap, header, new_size);
+	account_block(heap, header->size, 1);
+	return ptr;
+}
+
+// Returns the number of bytes that can actually be used in a block, which might be more than what was requested.
+u32 kalloc_heap_usable_size(const Kalloc_Heap* heap, const void* ptr) {
+	assert((u32)ptr >= heap->initial_addr + sizeof(Kalloc_Heap_Header) && (u32)ptr < heap->initial_addr + heap->size,
+		"kalloc: pointer 0x%x is not part of the heap.", ptr);
+	const Kalloc_Heap_Header* header = (const Kalloc_Heap_Header*)((const u8*)ptr - sizeof(Kalloc_Heap_Header));
+	assert(header->used == 1,
+		"kalloc: found hole in inconsistent state (expected used=1, but got used=%u).", header->used);
+	return header->size;
 }
 
 void kalloc_heap_print(const Kalloc_Heap* heap) {
@@ -223,6 +430,78 @@ void kalloc_heap_print(const Kalloc_Heap* heap) {
 	}
 	printf("******\n");
 }
+
+#ifdef KALLOC_TRACK_CALLERS
+// Maximum number of different callers listed by kalloc_heap_print_callers. Blocks of other callers are counted together.
+#define HEAP_MAX_REPORTED_CALLERS 32
+
+typedef struct {
+	u32 caller;
+	u32 blocks;
+	u32 bytes;
+	u32 oldest_timestamp;
+} Caller_Report;
+
+void kalloc_heap_tag_block(Kalloc_Heap* heap, void* ptr, u32 caller, u32 owner, u32 timestamp) {
+	Kalloc_Heap_Header* header = get_header(ptr);
+	header->caller = caller;
+	header->owner = owner;
+	header->timestamp = timestamp;
+}
+
+// Prints the used blocks of the heap, grouped by the call that allocated them. If 'owner' is not 0, only the blocks
+// allocated by that process are considered. Returns the number of blocks found.
+u32 kalloc_heap_print_callers(const Kalloc_Heap* heap, u32 owner) {
+	Caller_Report reports[HEAP_MAX_REPORTED_CALLERS + 1];
+	u32 num_reports = 0;
+	u32 blocks = 0;
+
+	Kalloc_Heap_Header* header = (Kalloc_Heap_Header*)heap->initial_addr;
+	while ((u8*)header < ((u8*)heap->initial_addr + heap->size)) {
+		if (header->used && (!owner || header->owner == owner)) {
+			u32 i = 0;
+			while (i < num_reports && i < HEAP_MAX_REPORTED_CALLERS && reports[i].caller != header->caller) {
+				++i;
+			}
+			if (i == num_reports) {
+				// The last report gathers all callers that don't fit
+				reports[i].caller = (i < HEAP_MAX_REPORTED_CALLERS) ? header->caller : 0;
+				reports[i].blocks = 0;
+				reports[i].bytes = 0;
+				reports[i].oldest_timestamp = header->timestamp;
+				++num_reports;
+			}
+			++reports[i].blocks;
+			reports[i].bytes += header->size;
+			reports[i].oldest_timestamp = MIN(reports[i].oldest_timestamp, header->timestamp);
+			++blocks;
+		}
+		header = (Kalloc_Heap_Header*)((u8*)header + sizeof(Kalloc_Heap_Header) + header->size + sizeof(Kalloc_Heap_Footer));
+	}
+
+	for (u32 i = 0; i < num_reports; ++i) {
+		printf("Heap: caller 0x%x has %u bytes in %u blocks (oldest allocated at %us)\n", reports[i].caller, reports[i].bytes,
+			reports[i].blocks, reports[i].oldest_timestamp);
+	}
+	return blocks;
+}
+#endif
+
+// The counters are kept up to date by every operation. The largest hole and the AVL height are only computed here.
+void kalloc_heap_get_statistics(const Kalloc_Heap* heap, Kalloc_Heap_Statistics* statistics) {
+	*statistics = heap->statistics;
+	statistics->heap_size = heap->size;
+	statistics->largest_hole = 0;
+	statistics->avl_height = 0;
+#ifdef TLSF_HEAP_ENABLED
+	for (Kalloc_Tlsf_Hole* hole = kalloc_tlsf_get_largest_holes(&heap->tlsf); hole; hole = hole->next) {
+		statistics->largest_hole = MAX(statistics->largest_hole, get_header(hole)->size);
+	}
+#else
+	statistics->largest_hole = kalloc_avl_get_largest_hole_size(&heap->avl);
+	statistics->avl_height = kalloc_avl_get_height(&heap->avl);
+#endif
+}
 #else
 #define KERNEL_PAGES 100
 u32 k_addr;
@@ -231,6 +510,9 @@ void kalloc_heap_create(Kalloc_Heap* heap, u32 initial_addr, u32 initial_pages)
 		paging_create_kernel_page_with_any_frame(initial_addr / PAGE_SIZE + i);
 	}
 	k_addr = initial_addr;
+	heap->initial_addr = initial_addr;
+	heap->size = KERNEL_PAGES * PAGE_SIZE;
+	memset(&heap->statistics, 0, sizeof(Kalloc_Heap_Statistics));
 }
 
 void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
@@ -243,6 +525,9 @@ void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
 	}
 	k_addr = aligned_addr;
 
+	++heap->statistics.allocations;
+	heap->statistics.used_bytes += size;
+	heap->statistics.peak_used_bytes = heap->statistics.used_bytes;
 	k_addr += size;
 	return (void*)(k_addr - size);
 }
@@ -250,6 +535,43 @@ void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment) {
 void kalloc_heap_free(Kalloc_Heap* heap, void* ptr) {
 }
 
+// The bump allocator doesn't know the size of its blocks, but everything between the old block and the new one
+// belongs to the old block (or to blocks allocated after it), so copying up to the new block is always safe.
+void* kalloc_heap_realloc(Kalloc_Heap* heap, void* ptr, u32 new_size) {
+	void* mem = kalloc_heap_alloc(heap, new_size, 0x0);
+	if (ptr) {
+		memcpy(mem, ptr, MIN(new_size, (u32)((u8*)mem - (u8*)ptr)));
+	}
+	return mem;
+}
+
+u32 kalloc_heap_usable_size(const Kalloc_Heap* heap, const void* ptr) {
+	panic("kalloc: the bump allocator does not keep the size of its blocks.");
+	return 0;
+}
+
 void kalloc_heap_print(const Kalloc_Heap* heap) {
 }
-#endif
\ No newline at end of file
+
+void kalloc_heap_get_statistics(const Kalloc_Heap* heap, Kalloc_Heap_Statistics* statistics) {
+	*statistics = heap->statistics;
+	statistics->heap_size = heap->size;
+}
+#endif
+
+void kalloc_heap_print_statistics(const Kalloc_Heap* heap) {
+	Kalloc_Heap_Statistics statistics;
+	kalloc_heap_get_statistics(heap, &statistics);
+	printf("Heap: %u bytes used in %u blocks (peak %u bytes), heap has %u bytes, %u holes (largest %u bytes), AVL height %u\n",
+		statistics.used_bytes, statistics.used_blocks, statistics.peak_used_bytes, statistics.heap_size, statistics.holes,
+		statistics.largest_hole, statistics.avl_height);
+	printf("Heap: %u allocs, %u frees, %u reallocs, %u expansions, %u trims\n", statistics.allocations, statistics.frees,
+		statistics.reallocations, statistics.expansions, statistics.trims);
+	printf("Heap: used blocks by size class:");
+	for (u32 i = 0; i < KALLOC_HEAP_SIZE_CLASSES; ++i) {
+		if (statistics.used_blocks_by_size_class[i]) {
+			printf(" %u:%u", 1 << i, statistics.used_blocks_by_size_class[i]);
+		}
+	}
+	printf("\n");
+}
\ No newline at end of file
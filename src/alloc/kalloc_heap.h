@@ -1,15 +1,65 @@
 #ifndef RAW_OS_ALLOC_KALLOC_HEAP_H
 #define RAW_OS_ALLOC_KALLOC_HEAP_H
 #include "kalloc_avl.h"
+#include "kalloc_tlsf.h"
+
+// Heap implementation, selected at build time:
+// - COMPLEX_HEAP_ENABLED: blocks and holes with boundary tags, holes are merged when freed.
+//   Holes are indexed by a TLSF if TLSF_HEAP_ENABLED is also defined, or by an AVL tree otherwise.
+// - Otherwise: a bump allocator that never frees memory.
+#define COMPLEX_HEAP_ENABLED
+#define TLSF_HEAP_ENABLED
+// If defined (and COMPLEX_HEAP_ENABLED too), each block remembers the call that allocated it, so leaks can be tracked down
+// (see kalloc_heap_print_callers). This makes the block header bigger.
+//#define KALLOC_TRACK_CALLERS
+// If defined, every kernel heap operation is written to the QEMU debug console, in the trace format of the host benchmark
+// (see bench/kalloc/bench.c and kalloc.c). Run with 'make trace' to record the trace to bin/kalloc.trace.
+//#define KALLOC_RECORD_TRACE
+#ifndef COMPLEX_HEAP_ENABLED
+#undef KALLOC_TRACK_CALLERS
+#endif
+
+// Used blocks are counted by size class: class N has the blocks of [2^N, 2^(N+1)) bytes, and the last class also has
+// all the bigger blocks.
+#define KALLOC_HEAP_SIZE_CLASSES 20
+
+typedef struct {
+	u32 allocations;
+	u32 frees;
+	u32 reallocations;
+	u32 used_blocks;
+	u32 used_bytes;					// Bytes in used blocks, without the block tags
+	u32 peak_used_bytes;
+	u32 holes;
+	u32 expansions;					// Number of times the heap grew
+	u32 trims;						// Number of times the heap gave its last pages back
+	u32 heap_size;					// Filled by kalloc_heap_get_statistics
+	u32 largest_hole;				// Filled by kalloc_heap_get_statistics
+	u32 avl_height;					// Filled by kalloc_heap_get_statistics (always 0 if the holes are in a TLSF)
+	u32 used_blocks_by_size_class[KALLOC_HEAP_SIZE_CLASSES];
+} Kalloc_Heap_Statistics;
+
 typedef struct {
-	u32 avl_initial_addr;
 	u32 initial_addr;
 	u32 size;
+	Kalloc_Heap_Statistics statistics;
+#ifdef TLSF_HEAP_ENABLED
+	Kalloc_Tlsf tlsf;
+#else
 	Kalloc_AVL avl;
+#endif
 } Kalloc_Heap;
 
 void kalloc_heap_create(Kalloc_Heap* heap, u32 initial_addr, u32 initial_pages);
 void* kalloc_heap_alloc(Kalloc_Heap* heap, u32 size, u32 alignment);
 void kalloc_heap_free(Kalloc_Heap* heap, void* ptr);
+void* kalloc_heap_realloc(Kalloc_Heap* heap, void* ptr, u32 new_size);
+u32 kalloc_heap_usable_size(const Kalloc_Heap* heap, const void* ptr);
 void kalloc_heap_print(const Kalloc_Heap* heap);
+void kalloc_heap_get_statistics(const Kalloc_Heap* heap, Kalloc_Heap_Statistics* statistics);
+void kalloc_heap_print_statistics(const Kalloc_Heap* heap);
+#ifdef KALLOC_TRACK_CALLERS
+void kalloc_heap_tag_block(Kalloc_Heap* heap, void* ptr, u32 caller, u32 owner, u32 timestamp);
+u32 kalloc_heap_print_callers(const Kalloc_Heap* heap, u32 owner);
+#endif
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "kalloc_slab.h"
+#include "kalloc.h"
+#include "../util/util.h"
+#include "../util/printf.h"
+#include "../util/bitmap.h"
+#include "../paging.h"
+
+#define PAGE_SIZE 4096
+#define SLAB_OBJECT_ALIGNMENT 8
+// Slabs grow (in powers of two) until they fit at least this many objects...
+#define SLAB_MIN_OBJECTS 8
+// ...or until they reach this size
+#define SLAB_MAX_SIZE (16 * PAGE_SIZE)
+
+#define ALIGN_UP(x, alignment) (((x) + (alignment) - 1) & ~((alignment) - 1))
+#define SLAB_HEADER_SIZE ALIGN_UP(sizeof(Kalloc_Slab), SLAB_OBJECT_ALIGNMENT)
+#define SLAB_SLOTS ((KALLOC_SLAB_AREA_END - KALLOC_SLAB_AREA_ADDRESS) / SLAB_MAX_SIZE)
+
+// One bit per slot of the slab area, set if a slab is using it
+static u32 slab_slots_data[SLAB_SLOTS / 32];
+static Bitmap slab_slots = { (u8*)slab_slots_data, sizeof(slab_slots_data), 0, 0 };
+
+static void slab_list_insert(Kalloc_Slab** list, Kalloc_Slab* slab) {
+	slab->previous = 0;
+	slab->next = *list;
+	if (*list) {
+		(*list)->previous = slab;
+	}
+	*list = slab;
+}
+
+static void slab_list_remove(Kalloc_Slab** list, Kalloc_Slab* slab) {
+	if (slab->previous) {
+		slab->previous->next = slab->next;
+	} else {
+		*list = slab->next;
+	}
+	if (slab->next) {
+		slab->next->previous = slab->previous;
+	}
+}
+
+static void update_slab_statistics(Kalloc_Slab_Cache* cache, s32 slabs_delta) {
+	u32 slab_waste = cache->slab_size - cache->objects_per_slab * cache->requested_size;
+	cache->statistics.slabs += slabs_delta;
+	cache->statistics.free_objects += slabs_delta * (s32)cache->objects_per_slab;
+	cache->statistics.wasted_bytes += slabs_delta * (s32)slab_waste;
+}
+
+// Slabs are aligned to their size, so the slab that owns an object can be found by masking the object address.
+// Each slab takes a slot of the slab area, which is aligned to the maximum slab size, and only the pages that the slab
+// needs are mapped.
+static Kalloc_Slab* create_slab(Kalloc_Slab_Cache* cache) {
+	u32 slot = bitmap_get_first_clear(&slab_slots);
+	bitmap_set(&slab_slots, slot);
+	Kalloc_Slab* slab = (Kalloc_Slab*)(KALLOC_SLAB_AREA_ADDRESS + slot * SLAB_MAX_SIZE);
+	for (u32 i = 0; i < cache->slab_size / PAGE_SIZE; ++i) {
+		paging_create_kernel_page_with_any_frame((u32)slab / PAGE_SIZE + i);
+	}
+	slab->cache = cache;
+	slab->used_objects = 0;
+
+	// All objects start in the free list, in address order
+	u8* first_object = (u8*)slab + SLAB_HEADER_SIZE;
+	for (u32 i = 0; i < cache->objects_per_slab - 1; ++i) {
+		*(void**)(first_object + i * cache->object_size) = first_object + (i + 1) * cache->object_size;
+	}
+	*(void**)(first_object + (cache->objects_per_slab - 1) * cache->object_size) = 0;
+	slab->free_objects = first_object;
+
+	update_slab_statistics(cache, 1);
+	return slab;
+}
+
+static void destroy_slab(Kalloc_Slab_Cache* cache, Kalloc_Slab* slab) {
+	update_slab_statistics(cache, -1);
+	for (u32 i = 0; i < cache->slab_size / PAGE_SIZE; ++i) {
+		paging_remove_kernel_page((u32)slab / PAGE_SIZE + i);
+	}
+	paging_tlb_flush();
+	bitmap_clear(&slab_slots, ((u32)slab - KALLOC_SLAB_AREA_ADDRESS) / SLAB_MAX_SIZE);
+}
+
+void kalloc_slab_cache_create(Kalloc_Slab_Cache* cache, const s8* name, u32 object_size) {
+	memset(cache, 0, sizeof(Kalloc_Slab_Cache));
+	cache->name = name;
+	cache->requested_size = object_size;
+	// Free objects hold a pointer to the next free object, so they can't be smaller than that
+	cache->object_size = ALIGN_UP(MAX(object_size, sizeof(void*)), SLAB_OBJECT_ALIGNMENT);
+	cache->slab_size = PAGE_SIZE;
+	while (cache->slab_size < SLAB_MAX_SIZE && (cache->slab_size - SLAB_HEADER_SIZE) / cache->object_size < SLAB_MIN_OBJECTS) {
+		cache->slab_size *= 2;
+	}
+	cache->objects_per_slab = (cache->slab_size - SLAB_HEADER_SIZE) / cache->object_size;
+	assert(cache->objects_per_slab > 0, "kalloc: objects of cache %s are too big for a slab (%u bytes).", name, object_size);
+}
+
+void* kalloc_slab_alloc(Kalloc_Slab_Cache* cache) {
+	Kalloc_Slab* slab = cache->partial_slabs;
+	if (!slab) {
+		if (cache->empty_slabs) {
+			slab = cache->empty_slabs;
+			slab_list_remove(&cache->empty_slabs, slab);
+		} else {
+			slab = create_slab(cache);
+		}
+		slab_list_insert(&cache->partial_slabs, slab);
+	}
+
+	void* object = slab->free_objects;
+	slab->free_objects = *(void**)object;
+	++slab->used_objects;
+	if (slab->used_objects == cache->objects_per_slab) {
+		slab_list_remove(&cache->partial_slabs, slab);
+		slab_list_insert(&cache->full_slabs, slab);
+	}
+
+	++cache->statistics.used_objects;
+	--cache->statistics.free_objects;
+	return object;
+}
+
+void kalloc_slab_free(Kalloc_Slab_Cache* cache, void* ptr) {
+	Kalloc_Slab* slab = (Kalloc_Slab*)((u32)ptr & ~(cache->slab_size - 1));
+	assert(slab->cache == cache, "kalloc: object 0x%x does not belong to cache %s.", ptr, cache->name);
+	assert(slab->used_objects > 0, "kalloc: object 0x%x of cache %s was freed twice.", ptr, cache->name);
+
+	*(void**)ptr = slab->free_objects;
+	slab->free_objects = ptr;
+	if (slab->used_objects == cache->objects_per_slab) {
+		slab_list_remove(&cache->full_slabs, slab);
+		slab_list_insert(&cache->partial_slabs, slab);
+	}
+	--slab->used_objects;
+
+	--cache->statistics.used_objects;
+	++cache->statistics.free_objects;
+
+	if (slab->used_objects == 0) {
+		slab_list_remove(&cache->partial_slabs, slab);
+		if (cache->empty_slabs) {
+			destroy_slab(cache, slab);
+		} else {
+			slab_list_insert(&cache->empty_slabs, slab);
+		}
+	}
+}
+
+void kalloc_slab_cache_get_statistics(const Kalloc_Slab_Cache* cache, Kalloc_Slab_Cache_Statistics* statistics) {
+	*statistics = cache->statistics;
+}
+
+void kalloc_slab_cache_print_statistics(const Kalloc_Slab_Cache* cache) {
+	const Kalloc_Slab_Cache_Statistics* statistics = &cache->statistics;
+	printf("Cache %s: %u objects used, %u free, %u slabs of %u bytes (%u bytes wasted)\n", cache->name, statistics->used_objects,
+		statistics->free_objects, statistics->slabs, cache->slab_size, statistics->wasted_bytes);
+}
@@ -0,0 +1,44 @@
+#ifndef RAW_OS_ALLOC_KALLOC_SLAB_H
+#define RAW_OS_ALLOC_KALLOC_SLAB_H
+#include "../common.h"
+// Object caches for fixed-size kernel objects. Each cache owns slabs (blocks of kernel pages, outside of the kernel heap)
+// that are split into objects of the same size, so allocating and freeing an object is just a free list operation.
+
+// Kernel pages reserved for slabs. The area is split into slots of the maximum slab size, and each slab takes one slot.
+// @NOTE: If these values are changed, the kernel address space layout in paging.c must be updated aswell.
+#define KALLOC_SLAB_AREA_ADDRESS 0x34000000
+#define KALLOC_SLAB_AREA_END 0x38000000
+
+typedef struct Kalloc_Slab {
+	struct Kalloc_Slab* previous;
+	struct Kalloc_Slab* next;
+	struct Kalloc_Slab_Cache* cache;
+	void* free_objects;				// Singly-linked list of free objects, stored inside the objects themselves
+	u32 used_objects;
+} Kalloc_Slab;
+
+typedef struct {
+	u32 slabs;						// Number of slabs owned by the cache
+	u32 used_objects;				// Number of objects currently allocated
+	u32 free_objects;				// Number of objects available in the slabs
+	u32 wasted_bytes;				// Bytes of the slabs that can never hold objects (slab header, padding and tail)
+} Kalloc_Slab_Cache_Statistics;
+
+typedef struct Kalloc_Slab_Cache {
+	const s8* name;
+	u32 requested_size;				// The size of the objects, as requested by the user
+	u32 object_size;				// The size of the objects, after alignment
+	u32 slab_size;					// The size of each slab, in bytes (a power of two multiple of the page size)
+	u32 objects_per_slab;
+	Kalloc_Slab* partial_slabs;		// Slabs with both used and free objects. Allocations are served from here first.
+	Kalloc_Slab* full_slabs;		// Slabs without free objects
+	Kalloc_Slab* empty_slabs;		// At most one slab without used objects, kept to avoid freeing and allocating slabs back and forth
+	Kalloc_Slab_Cache_Statistics statistics;
+} Kalloc_Slab_Cache;
+
+void kalloc_slab_cache_create(Kalloc_Slab_Cache* cache, const s8* name, u32 object_size);
+void* kalloc_slab_alloc(Kalloc_Slab_Cache* cache);
+void kalloc_slab_free(Kalloc_Slab_Cache* cache, void* ptr);
+void kalloc_slab_cache_get_statistics(const Kalloc_Slab_Cache* cache, Kalloc_Slab_Cache_Statistics* statistics);
+void kalloc_slab_cache_print_statistics(const Kalloc_Slab_Cache* cache);
+#endif
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "../paging.h"
 #include "../util/util.h"
 #include "../screen.h"
+#include "../util/printf.h"
+#include "../asm/util.h"
 
 #define HEAP_HEADER_MAGIC 0xABCD
 #define HEAP_FOOTER_MAGIC 0xEF01
@@ -11,6 +13,11 @@ typedef struct {
 	u16 magic;
 	u32 size;
 	s32 used;
+#ifdef KALLOC_TRACK_CALLERS
+	u32 caller;
+	u32 owner;
+	u32 timestamp;
+#endif
 } Kalloc_Heap_Header;
 
 typedef struct {
@@ -26,6 +33,10 @@ typedef struct {
 Allocd_Data* alloc_datas;
 u32 alloc_datas_size = 0;
 
+// Worst-case latency of the heap operations, so the heap implementations (see kalloc_heap.h) can be compared
+u32 max_alloc_cycles = 0;
+u32 max_free_cycles = 0;
+
 u32 rand_aux = 132145;
 s32 rand() {
 	rand_aux += 132145;
@@ -34,8 +45,16 @@ s32 rand() {
 
 static void check_heap(const Kalloc_Heap* heap) {
 	// Check overall heap structure
+	u32 used_blocks = 0, used_bytes = 0, holes = 0, largest_hole = 0;
 	Kalloc_Heap_Header* header = (Kalloc_Heap_Header*)heap->initial_addr;
 	while ((u8*)header < ((u8*)heap->initial_addr + heap->size)) {
+		if (header->used) {
+			++used_blocks;
+			used_bytes += header->size;
+		} else {
+			++holes;
+			largest_hole = MAX(largest_hole, header->size);
+		}
 		Kalloc_Heap_Footer* footer = (Kalloc_Heap_Footer*)((u8*)header + sizeof(Kalloc_Heap_Header) + header->size);
 		assert(footer->header == header, "footer->header == header (0x%u == 0x%u)", footer->header, header);
 		assert(footer->magic == HEAP_FOOTER_MAGIC, "footer->magic == HEAP_FOOTER_MAGIC (0x%u == 0x%u)", footer->magic, HEAP_FOOTER_MAGIC);
@@ -44,6 +63,15 @@ static void check_heap(const Kalloc_Heap* heap) {
 		header = (Kalloc_Heap_Header*)((u8*)header + sizeof(Kalloc_Heap_Header) + header->size + sizeof(Kalloc_Heap_Footer));
 	}
 
+	// Check that the statistics match the heap
+	Kalloc_Heap_Statistics statistics;
+	kalloc_heap_get_statistics(heap, &statistics);
+	assert(statistics.used_blocks == used_blocks, "statistics.used_blocks == used_blocks (%u == %u)", statistics.used_blocks, used_blocks);
+	assert(statistics.used_bytes == used_bytes, "statistics.used_bytes == used_bytes (%u == %u)", statistics.used_bytes, used_bytes);
+	assert(statistics.holes == holes, "statistics.holes == holes (%u == %u)", statistics.holes, holes);
+	assert(statistics.largest_hole == largest_hole, "statistics.largest_hole == largest_hole (%u == %u)", statistics.largest_hole,
+		largest_hole);
+
 	// Check that we are not receiving same addresses
 	for (u32 i = 0; i < alloc_datas_size; ++i) {
 		Allocd_Data current = alloc_datas[i];
@@ -62,7 +90,9 @@ static void check_heap(const Kalloc_Heap* heap) {
 
 static void alloc_data(Kalloc_Heap* heap, u32 size, u32 alignment) {
 	Allocd_Data ad;
+	u64 start = util_rdtsc();
 	ad.ptr = kalloc_heap_alloc(heap, size, alignment);
+	max_alloc_cycles = MAX(max_alloc_cycles, (u32)(util_rdtsc() - start));
 	if (alignment != 0) {
 		assert((u32)ad.ptr % alignment == 0, "tried to allocate aligned data, but received data was not aligned (received 0x%u)", ad.ptr);
 	}
@@ -77,7 +107,9 @@ static void free_random_data(Kalloc_Heap* heap) {
 	
 	// We never free the first entry, because when the heap is empty, we cannot allocate aligned data.
 	if (selected_index > 0) {
+		u64 start = util_rdtsc();
 		kalloc_heap_free(heap, alloc_datas[selected_index].ptr);
+		max_free_cycles = MAX(max_free_cycles, (u32)(util_rdtsc() - start));
 
 		for (u32 i = selected_index; i < alloc_datas_size - 1; ++i){ 
 			alloc_datas[i] = alloc_datas[i + 1];
@@ -87,6 +119,28 @@ static void free_random_data(Kalloc_Heap* heap) {
 	}
 }
 
+static void realloc_random_data(Kalloc_Heap* heap) {
+	u32 selected_index = rand() % alloc_datas_size;
+
+	// Same as free_random_data, the first entry is never touched
+	if (selected_index > 0) {
+		Allocd_Data* ad = &alloc_datas[selected_index];
+		u32 new_size = (u32)rand() % 4096;
+		u8 pattern = (u8)rand();
+		memset(ad->ptr, pattern, ad->size);
+
+		u8* new_ptr = kalloc_heap_realloc(heap, ad->ptr, new_size);
+		for (u32 i = 0; i < MIN(ad->size, new_size); ++i) {
+			assert(new_ptr[i] == pattern, "realloc did not preserve the data (byte %u is 0x%x, expected 0x%x)", i, new_ptr[i], pattern);
+		}
+		assert(kalloc_heap_usable_size(heap, new_ptr) >= new_size, "usable size is smaller than the requested size (%u < %u)",
+			kalloc_heap_usable_size(heap, new_ptr), new_size);
+		ad->ptr = new_ptr;
+		ad->size = new_size;
+		check_heap(heap);
+	}
+}
+
 void kalloc_test(Kalloc_Heap* empty_heap) {
 	const u32 alloc_data_addr = 0x10000000;
 	for (u32 i = 0; i < 128; ++i) {
@@ -136,5 +190,87 @@ void kalloc_test(Kalloc_Heap* empty_heap) {
 			free_random_data(empty_heap);
 		}
 	}
+	for (u32 i = 0; i < 2000; ++i) {
+		u32 r = rand() % 100;
+		if (r < 30 || alloc_datas_size == 0) {
+			u32 size = (u32)rand() % 1024;
+			alloc_data(empty_heap, size, 0);
+		} else if (r < 40) {
+			free_random_data(empty_heap);
+		} else {
+			realloc_random_data(empty_heap);
+		}
+	}
 	kalloc_heap_print(empty_heap);
+	printf("kalloc_test: worst-case alloc took %u cycles, worst-case free took %u cycles\n", max_alloc_cycles, max_free_cycles);
+}
+
+static u32 count_holes(const Kalloc_Heap* heap) {
+	u32 holes = 0;
+	Kalloc_Heap_Header* header = (Kalloc_Heap_Header*)heap->initial_addr;
+	while ((u8*)header < ((u8*)heap->initial_addr + heap->size)) {
+		holes += !header->used;
+		header = (Kalloc_Heap_Header*)((u8*)header + sizeof(Kalloc_Heap_Header) + header->size + sizeof(Kalloc_Heap_Footer));
+	}
+	return holes;
+}
+
+// Allocates 'num_blocks' blocks of random sizes. Each block stores a pointer to the previously allocated block,
+// so millions of blocks can be tracked without any extra memory. Returns the last allocated block.
+static void** alloc_block_chain(Kalloc_Heap* heap, u32 num_blocks) {
+	void** last = 0;
+	for (u32 i = 0; i < num_blocks; ++i) {
+		u32 size = sizeof(void*) + (u32)rand() % 64;
+		u64 start = util_rdtsc();
+		void** block = kalloc_heap_alloc(heap, size, 0);
+		max_alloc_cycles = MAX(max_alloc_cycles, (u32)(util_rdtsc() - start));
+		*block = last;
+		last = block;
+	}
+	return last;
+}
+
+static void free_block(Kalloc_Heap* heap, void* block) {
+	u64 start = util_rdtsc();
+	kalloc_heap_free(heap, block);
+	max_free_cycles = MAX(max_free_cycles, (u32)(util_rdtsc() - start));
+}
+
+// Stress mode: leaves 'num_holes' holes in the heap that can't be merged (every other block is freed), then allocates
+// the same number of blocks again and finally frees everything. The heap must end up as a single hole.
+void kalloc_test_stress(Kalloc_Heap* empty_heap, u32 num_holes) {
+	alloc_datas_size = 0;
+	max_alloc_cycles = 0;
+	max_free_cycles = 0;
+
+	void** first_chain = alloc_block_chain(empty_heap, 2 * num_holes);
+	for (void** block = first_chain; block && *block; block = *block) {
+		void** freed_block = *block;
+		*block = *freed_block;
+		free_block(empty_heap, freed_block);
+	}
+	check_heap(empty_heap);
+	u32 holes = count_holes(empty_heap);
+	assert(holes >= num_holes, "kalloc_test: expected at least %u holes, but got %u", num_holes, holes);
+	printf("kalloc_test: %u holes in a heap of %u bytes\n", holes, empty_heap->size);
+
+	void** second_chain = alloc_block_chain(empty_heap, num_holes);
+	check_heap(empty_heap);
+
+	while (first_chain) {
+		void** next = *first_chain;
+		free_block(empty_heap, first_chain);
+		first_chain = next;
+	}
+	while (second_chain) {
+		void** next = *second_chain;
+		free_block(empty_heap, second_chain);
+		second_chain = next;
+	}
+	check_heap(empty_heap);
+	holes = count_holes(empty_heap);
+	assert(holes == 1, "kalloc_test: expected a single hole after freeing everything, but got %u", holes);
+
+	printf("kalloc_test: stress with %u holes passed (worst-case alloc took %u cycles, worst-case free took %u cycles)\n",
+		num_holes, max_alloc_cycles, max_free_cycles);
 }
\ No newline at end of file
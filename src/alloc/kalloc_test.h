@@ -2,4 +2,5 @@
 #define RAW_OS_ALLOC_KALLOC_TEST_H
 #include "kalloc_heap.h"
 void kalloc_test(Kalloc_Heap* empty_heap);
+void kalloc_test_stress(Kalloc_Heap* empty_heap, u32 num_holes);
 #endif
\ No newline at end of file
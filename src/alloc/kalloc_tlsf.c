@@ -0,0 +1,118 @@
+#include "kalloc_tlsf.h"
+#include "../util/util.h"
+
+// Index of the most significant bit set. 'x' can't be 0.
+static u32 find_last_set(u32 x) {
+	return 31 - __builtin_clz(x);
+}
+
+// Index of the least significant bit set. 'x' can't be 0.
+static u32 find_first_set(u32 x) {
+	return __builtin_ctz(x);
+}
+
+// Gets the list where a hole of the given size belongs.
+static void mapping_insert(u32 size, u32* fl, u32* sl) {
+	if (size < KALLOC_TLSF_SMALL_SIZE) {
+		*fl = 0;
+		*sl = size / (KALLOC_TLSF_SMALL_SIZE / KALLOC_TLSF_SL_COUNT);
+	} else {
+		u32 last_set = find_last_set(size);
+		*fl = last_set - (KALLOC_TLSF_FL_SHIFT - 1);
+		*sl = (size >> (last_set - KALLOC_TLSF_SL_COUNT_LOG2)) ^ KALLOC_TLSF_SL_COUNT;
+	}
+}
+
+// Gets the first list where all holes are big enough for the given size.
+// The size is rounded up to the next class, so we never need to look at the holes themselves.
+static s32 mapping_search(u32 size, u32* fl, u32* sl) {
+	u32 round = (size < KALLOC_TLSF_SMALL_SIZE) ? KALLOC_TLSF_SMALL_SIZE / KALLOC_TLSF_SL_COUNT - 1
+		: (1 << (find_last_set(size) - KALLOC_TLSF_SL_COUNT_LOG2)) - 1;
+	if (size > 0xFFFFFFFF - round) {
+		return -1;
+	}
+	size += round;
+	mapping_insert(size, fl, sl);
+	return 0;
+}
+
+void kalloc_tlsf_init(Kalloc_Tlsf* tlsf) {
+	memset(tlsf, 0, sizeof(Kalloc_Tlsf));
+}
+
+// Finds a hole with at least 'hole_size' bytes after its address is aligned to 'alignment'.
+// Any hole of the first non-empty list is used, so the hole might be bigger than needed (but never by more than a class).
+void* kalloc_tlsf_find_hole(const Kalloc_Tlsf* tlsf, u32 hole_size, u32 alignment) {
+	u32 fl, sl;
+	// In the worst case, 'alignment - 1' bytes are lost to align the address
+	u32 wanted_size = hole_size + (alignment ? alignment - 1 : 0);
+	if (wanted_size < hole_size || mapping_search(wanted_size, &fl, &sl)) {
+		return 0;
+	}
+	if (fl >= KALLOC_TLSF_FL_COUNT) {
+		return 0;
+	}
+
+	u32 sl_map = tlsf->sl_bitmaps[fl] & (0xFFFFFFFF << sl);
+	if (!sl_map) {
+		u32 fl_map = tlsf->fl_bitmap & (0xFFFFFFFF << (fl + 1));
+		if (!fl_map) {
+			return 0;
+		}
+		fl = find_first_set(fl_map);
+		sl_map = tlsf->sl_bitmaps[fl];
+	}
+	sl = find_first_set(sl_map);
+	return tlsf->free_lists[fl][sl];
+}
+
+s32 kalloc_tlsf_insert(Kalloc_Tlsf* tlsf, u32 hole_size, void* hole_addr) {
+	assert(hole_size >= KALLOC_TLSF_MIN_HOLE_SIZE, "kalloc_tlsf: hole is too small (%u bytes)", hole_size);
+	u32 fl, sl;
+	mapping_insert(hole_size, &fl, &sl);
+
+	Kalloc_Tlsf_Hole* hole = hole_addr;
+	hole->previous = 0;
+	hole->next = tlsf->free_lists[fl][sl];
+	if (hole->next) {
+		hole->next->previous = hole;
+	}
+	tlsf->free_lists[fl][sl] = hole;
+	tlsf->fl_bitmap |= 1 << fl;
+	tlsf->sl_bitmaps[fl] |= 1 << sl;
+	return 0;
+}
+
+s32 kalloc_tlsf_remove(Kalloc_Tlsf* tlsf, u32 hole_size, void* hole_addr) {
+	u32 fl, sl;
+	mapping_insert(hole_size, &fl, &sl);
+
+	Kalloc_Tlsf_Hole* hole = hole_addr;
+	if (hole->previous) {
+		hole->previous->next = hole->next;
+	} else {
+		assert(tlsf->free_lists[fl][sl] == hole, "kalloc_tlsf: hole 0x%x is not in the list of its size (%u)", hole_addr, hole_size);
+		tlsf->free_lists[fl][sl] = hole->next;
+		if (!hole->next) {
+			tlsf->sl_bitmaps[fl] &= ~(1 << sl);
+			if (!tlsf->sl_bitmaps[fl]) {
+				tlsf->fl_bitmap &= ~(1 << fl);
+			}
+		}
+	}
+	if (hole->next) {
+		hole->next->previous = hole->previous;
+	}
+	return 0;
+}
+
+// Returns the list of the biggest size class that has holes, or 0 if there are no holes.
+// The holes don't know their own size, so finding the largest one is up to the caller.
+Kalloc_Tlsf_Hole* kalloc_tlsf_get_largest_holes(const Kalloc_Tlsf* tlsf) {
+	if (!tlsf->fl_bitmap) {
+		return 0;
+	}
+	u32 fl = find_last_set(tlsf->fl_bitmap);
+	u32 sl = find_last_set(tlsf->sl_bitmaps[fl]);
+	return tlsf->free_lists[fl][sl];
+}
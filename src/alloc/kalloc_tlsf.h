@@ -0,0 +1,34 @@
+#ifndef RAW_OS_ALLOC_KALLOC_TLSF_H
+#define RAW_OS_ALLOC_KALLOC_TLSF_H
+#include "../common.h"
+// Two-level segregated fit (TLSF) index of heap holes. Holes are kept in one free list per size class.
+// The first level splits sizes in powers of two, and the second level splits each power of two in KALLOC_TLSF_SL_COUNT
+// linear classes. A bitmap per level tells which lists are not empty, so finding, inserting and removing a hole are O(1).
+
+#define KALLOC_TLSF_SL_COUNT_LOG2 4
+#define KALLOC_TLSF_SL_COUNT (1 << KALLOC_TLSF_SL_COUNT_LOG2)
+// Holes smaller than this are all kept in the first level, in classes of (KALLOC_TLSF_SMALL_SIZE / KALLOC_TLSF_SL_COUNT) bytes
+#define KALLOC_TLSF_FL_SHIFT (KALLOC_TLSF_SL_COUNT_LOG2 + 2)
+#define KALLOC_TLSF_SMALL_SIZE (1 << KALLOC_TLSF_FL_SHIFT)
+#define KALLOC_TLSF_FL_COUNT (32 - KALLOC_TLSF_FL_SHIFT + 1)
+// The free list links are stored inside the holes, so holes must have at least this many bytes
+#define KALLOC_TLSF_MIN_HOLE_SIZE sizeof(Kalloc_Tlsf_Hole)
+
+typedef struct Kalloc_Tlsf_Hole {
+	struct Kalloc_Tlsf_Hole* previous;
+	struct Kalloc_Tlsf_Hole* next;
+} Kalloc_Tlsf_Hole;
+
+typedef struct {
+	u32 fl_bitmap;										// Bit N is set if any list of the first level N is not empty
+	u32 sl_bitmaps[KALLOC_TLSF_FL_COUNT];				// Bit M of entry N is set if the list [N][M] is not empty
+	Kalloc_Tlsf_Hole* free_lists[KALLOC_TLSF_FL_COUNT][KALLOC_TLSF_SL_COUNT];
+} Kalloc_Tlsf;
+
+void kalloc_tlsf_init(Kalloc_Tlsf* tlsf);
+void* kalloc_tlsf_find_hole(const Kalloc_Tlsf* tlsf, u32 hole_size, u32 alignment);
+s32 kalloc_tlsf_insert(Kalloc_Tlsf* tlsf, u32 hole_size, void* hole_addr);
+s32 kalloc_tlsf_remove(Kalloc_Tlsf* tlsf, u32 hole_size, void* hole_addr);
+Kalloc_Tlsf_Hole* kalloc_tlsf_get_largest_holes(const Kalloc_Tlsf* tlsf);
+
+#endif
\ No newline at end of file
@@ -1,8 +1,16 @@
 ; This will be the first loaded content by the bootstrap process, so it is the kernel entrypoint.
-; We just call the main function
+; We zero the .bss section, since the boot sector only loads the kernel image, and call the main function
 [bits 32]
 [extern main]
-mov ebp, 0xC0000000                ; Change kernel stack to 0xC0000000
-mov esp, ebp                       ; NOTE: If this value is changed, the constant in paging.c needs to be changed aswell.
+[extern bss]
+[extern end]
+mov edi, bss                       ; .bss goes from 'bss' to 'end' (see link.ld)
+mov ecx, end
+sub ecx, edi
+xor eax, eax
+cld
+rep stosb
+mov ebp, 0x90000                   ; Use the boot stack until paging is enabled (see BOOT_STACK_ADDRESS)
+mov esp, ebp                       ; NOTE: If this value is changed, the constant in paging.h needs to be changed aswell.
 call main
-jmp $
\ No newline at end of file
+jmp $
@@ -1,9 +1,15 @@
 global paging_switch_page_directory
 global paging_get_faulting_address
-global paging_copy_frame
-global paging_compare_frame
+global paging_copy_frame_with_paging_disabled
+global paging_invalidate_page
+global paging_set_global_pages
+global paging_enable_large_pages
+global paging_copy_page
+global paging_compare_page
+global paging_zero_page
 
 ; enable paging and switch to page directory received as parameter
+; CR0.WP is also set, so the kernel respects read-only pages (needed for copy-on-write).
 ; NOTE (IMPORTANT): Instead of returning via 'ret', we store the returning address in ecx
 ; and jmp to ecx in the end of the function.
 ; This is done to avoid relying on the stack after we switch the page directory.
@@ -15,7 +21,7 @@ paging_switch_page_directory:
 	mov eax, [esp + 4]
 	mov cr3, eax
 	mov eax, cr0
-	or eax, 0x80000000
+	or eax, 0x80010000	; PG and WP
 	mov cr0, eax
 	jmp ecx
 
@@ -25,40 +31,81 @@ paging_get_faulting_address:
 	mov eax, cr2
 	ret
 
-; disables paging and copies one frame (4KB) to another
-paging_copy_frame:
-	push ebp
-	mov ebp, esp
-	push ebx
-	pushf				; push EFLAGS. We restore them later, so if interrupts were enabled, we re-enable them
-	cli					; disable interrupts
-	mov eax, [ebp + 12]	; frame_src_addr
-	mov ecx, [ebp + 8]	; frame_dst_addr
+; invalidates the tlb entry of a single page
+; void paging_invalidate_page(u32 addr);
+paging_invalidate_page:
+	mov eax, [esp + 4]
+	invlpg [eax]
+	ret
 
-	mov edx, cr0
-	and edx, 0x7FFFFFFF
-	mov cr0, edx		; disable paging
+; enables or disables global pages (CR4.PGE). Changing this flag flushes the whole TLB, including global entries.
+; void paging_set_global_pages(u32 enabled);
+paging_set_global_pages:
+	mov ecx, [esp + 4]
+	mov eax, cr4
+	and eax, ~0x80
+	test ecx, ecx
+	jz paging_set_global_pages_done
+	or eax, 0x80	; PGE
+paging_set_global_pages_done:
+	mov cr4, eax
+	ret
 
-	mov edx, 1024
-paging_copy_frame_loop:
-	mov ebx, [eax]
-	mov [ecx], ebx 
-	add ecx, 4
-	add eax, 4
-	dec edx
-	jnz paging_copy_frame_loop
+; enables 4MB pages (CR4.PSE). Must be called before paging is enabled if the page directory already has 4MB pages.
+; void paging_enable_large_pages();
+paging_enable_large_pages:
+	mov eax, cr4
+	or eax, 0x10	; PSE
+	mov cr4, eax
+	ret
 
-	mov edx, cr0
-	or edx, 0x80000000
-	mov cr0, edx
+; copies one page (4KB) to another. Both addresses are virtual addresses.
+; void paging_copy_page(void* dst, const void* src);
+paging_copy_page:
+	push esi
+	push edi
+	mov edi, [esp + 12]	; dst
+	mov esi, [esp + 16]	; src
+	mov ecx, 1024
+	cld
+	rep movsd
+	pop edi
+	pop esi
+	ret
 
-	popf
-	pop ebx
-	pop ebp
+; compares one page (4KB) to another. Both addresses are virtual addresses.
+; returns 0 if they are equal, 1 otherwise
+; s32 paging_compare_page(const void* page1, const void* page2);
+paging_compare_page:
+	push esi
+	push edi
+	mov edi, [esp + 12]	; page1
+	mov esi, [esp + 16]	; page2
+	mov ecx, 1024
+	cld
+	repe cmpsd
+	setne al
+	movzx eax, al
+	pop edi
+	pop esi
 	ret
 
-; disables paging and compares one frame (4KB) to another
-paging_compare_frame:
+; zeroes one page (4KB). The address is a virtual address.
+; void paging_zero_page(void* page);
+paging_zero_page:
+	push edi
+	mov edi, [esp + 8]	; page
+	xor eax, eax
+	mov ecx, 1024
+	cld
+	rep stosd
+	pop edi
+	ret
+
+; disables paging and copies one frame (4KB) to another
+; NOTE: this is the old way of copying frames. It is only kept so it can be compared against 'paging_copy_frame'
+; (see paging_benchmark.c), since it is much slower: disabling paging flushes the whole tlb.
+paging_copy_frame_with_paging_disabled:
 	push ebp
 	mov ebp, esp
 	push ebx
@@ -72,17 +119,13 @@ paging_compare_frame:
 	mov cr0, edx		; disable paging
 
 	mov edx, 1024
-paging_compare_frame_loop:
+paging_copy_frame_loop:
 	mov ebx, [eax]
-	cmp ebx, [ecx]
-	je paging_compare_frame_same_frame
-	mov eax, 1
-	ret
-paging_compare_frame_same_frame:
+	mov [ecx], ebx 
 	add ecx, 4
 	add eax, 4
 	dec edx
-	jnz paging_compare_frame_loop
+	jnz paging_copy_frame_loop
 
 	mov edx, cr0
 	or edx, 0x80000000
@@ -91,5 +134,4 @@ paging_compare_frame_same_frame:
 	popf
 	pop ebx
 	pop ebp
-	mov eax, 0
 	ret
\ No newline at end of file
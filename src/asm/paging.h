@@ -4,6 +4,11 @@
 #include "../paging.h"
 void paging_switch_page_directory(u32 page_directory_frame_addr);
 u32 paging_get_faulting_address();
-void paging_copy_frame(u32 frame_dst_addr, u32 frame_src_addr);
-s32 paging_compare_frame(u32 frame_dst_addr, u32 frame_src_addr);
+void paging_invalidate_page(u32 addr);
+void paging_set_global_pages(u32 enabled);
+void paging_enable_large_pages();
+void paging_copy_page(void* dst, const void* src);
+s32 paging_compare_page(const void* page1, const void* page2);
+void paging_zero_page(void* page);
+void paging_copy_frame_with_paging_disabled(u32 frame_dst_addr, u32 frame_src_addr);
 #endif
\ No newline at end of file
@@ -18,6 +18,16 @@ global syscall_write_stub
 global syscall_write_stub_size
 global syscall_close_stub
 global syscall_close_stub_size
+global syscall_mmap_stub
+global syscall_mmap_stub_size
+global syscall_munmap_stub
+global syscall_munmap_stub_size
+global syscall_mprotect_stub
+global syscall_mprotect_stub_size
+global syscall_brk_stub
+global syscall_brk_stub_size
+global syscall_sbrk_stub
+global syscall_sbrk_stub_size
 
 ; NOTE: syscall stubs are using stdcall for now
 ; @TODO: ebx can't be destroyed in stdcall
@@ -93,4 +103,44 @@ syscall_close_stub:
 	mov ebx, [esp + 4]
 	int 0x80
 	ret 4
-syscall_close_stub_size: dd syscall_close_stub_size - syscall_close_stub
\ No newline at end of file
+syscall_close_stub_size: dd syscall_close_stub_size - syscall_close_stub
+
+syscall_mmap_stub:
+	mov eax, 10
+	mov ebx, [esp + 4]
+	mov ecx, [esp + 8]
+	mov edx, [esp + 12]
+	int 0x80
+	ret 12
+syscall_mmap_stub_size: dd syscall_mmap_stub_size - syscall_mmap_stub
+
+syscall_munmap_stub:
+	mov eax, 11
+	mov ebx, [esp + 4]
+	mov ecx, [esp + 8]
+	int 0x80
+	ret 8
+syscall_munmap_stub_size: dd syscall_munmap_stub_size - syscall_munmap_stub
+
+syscall_mprotect_stub:
+	mov eax, 12
+	mov ebx, [esp + 4]
+	mov ecx, [esp + 8]
+	mov edx, [esp + 12]
+	int 0x80
+	ret 12
+syscall_mprotect_stub_size: dd syscall_mprotect_stub_size - syscall_mprotect_stub
+
+syscall_brk_stub:
+	mov eax, 13
+	mov ebx, [esp + 4]
+	int 0x80
+	ret 4
+syscall_brk_stub_size: dd syscall_brk_stub_size - syscall_brk_stub
+
+syscall_sbrk_stub:
+	mov eax, 14
+	mov ebx, [esp + 4]
+	int 0x80
+	ret 4
+syscall_sbrk_stub_size: dd syscall_sbrk_stub_size - syscall_sbrk_stub
\ No newline at end of file
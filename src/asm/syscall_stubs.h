@@ -21,4 +21,14 @@ void syscall_write_stub();
 extern u32 syscall_write_stub_size;
 void syscall_close_stub();
 extern u32 syscall_close_stub_size;
+void syscall_mmap_stub();
+extern u32 syscall_mmap_stub_size;
+void syscall_munmap_stub();
+extern u32 syscall_munmap_stub_size;
+void syscall_mprotect_stub();
+extern u32 syscall_mprotect_stub_size;
+void syscall_brk_stub();
+extern u32 syscall_brk_stub_size;
+void syscall_sbrk_stub();
+extern u32 syscall_sbrk_stub_size;
 #endif
\ No newline at end of file
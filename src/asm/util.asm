@@ -1,10 +1,26 @@
 global util_get_eip
 global util_get_ebp
 global util_get_esp
+global util_rdtsc
+global util_switch_stack_and_call
 
 section .data
 section .text
 
 util_get_eip:
 	pop eax
-	jmp eax
\ No newline at end of file
+	jmp eax
+
+; returns the time-stamp counter (in edx:eax)
+util_rdtsc:
+	rdtsc
+	ret
+
+; moves esp and ebp to 'stack_addr' and calls 'func'. The old stack is abandoned, so 'func' must never return.
+; void util_switch_stack_and_call(u32 stack_addr, void (*func)());
+util_switch_stack_and_call:
+	mov eax, [esp + 8]	; func
+	mov esp, [esp + 4]	; stack_addr
+	mov ebp, esp
+	call eax
+	jmp $
\ No newline at end of file
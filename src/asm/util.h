@@ -2,4 +2,6 @@
 #define RAW_OS_ASM_UTIL_H
 #include "../common.h"
 u32 util_get_eip();
+u64 util_rdtsc();
+void util_switch_stack_and_call(u32 stack_addr, void (*func)());
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 typedef double r64;
 typedef float r32;
+typedef unsigned long long u64;
+typedef long long s64;
 typedef unsigned int u32;
 typedef int s32;
 typedef unsigned short u16;
@@ -1,16 +1,39 @@
 #include "dev.h"
 #include "../screen.h"
 #include "../util/util.h"
-#include "../alloc/kalloc.h"
 #include "../keyboard.h"
 #include "../util/printf.h"
+#include "../alloc/kalloc.h"
+#include "../paging.h"
 
 #define SCREEN_FILE_NAME "screen"
 #define KEYBOARD_FILE_NAME "keyboard"
+// Reading this file returns the kernel heap statistics (a Kalloc_Heap_Statistics struct)
+#define KHEAP_FILE_NAME "kheap"
+// Reading this file returns the TLB statistics (a Paging_Tlb_Statistics struct)
+#define TLB_FILE_NAME "tlb"
+// Reading this file returns the free blocks of contiguous frames of each order (a Paging_Frames_Statistics struct)
+#define FRAMES_FILE_NAME "frames"
+// Reading this file returns the statistics of the pool of pre-zeroed frames (a Paging_Zero_Pool_Statistics struct)
+#define ZERO_POOL_FILE_NAME "zeropool"
 
 Vfs_Node* dev_root_node;
 Vfs_Node* screen_node;
 Vfs_Node* keyboard_node;
+Vfs_Node* kheap_node;
+Vfs_Node* tlb_node;
+Vfs_Node* frames_node;
+Vfs_Node* zero_pool_node;
+
+// Copies the part of a statistics struct that was asked for. Returns the number of bytes read.
+static s32 read_statistics(const void* statistics, u32 statistics_size, u32 offset, u32 size, void* buf) {
+	if (offset >= statistics_size) {
+		return 0;
+	}
+	u32 read_size = MIN(size, statistics_size - offset);
+	memcpy(buf, (const u8*)statistics + offset, read_size);
+	return read_size;
+}
 
 static s32 dev_read(Vfs_Node* vfs_node, u32 offset, u32 size, void* buf) {
 	if (vfs_node == keyboard_node) {
@@ -25,6 +48,22 @@ static s32 dev_read(Vfs_Node* vfs_node, u32 offset, u32 size, void* buf) {
 		while (!kerb.event_received);
 
 		return kerb.buffer_filled;
+	} else if (vfs_node == kheap_node) {
+		Kalloc_Heap_Statistics statistics;
+		kalloc_get_statistics(&statistics);
+		return read_statistics(&statistics, sizeof(Kalloc_Heap_Statistics), offset, size, buf);
+	} else if (vfs_node == tlb_node) {
+		Paging_Tlb_Statistics statistics;
+		paging_get_tlb_statistics(&statistics);
+		return read_statistics(&statistics, sizeof(Paging_Tlb_Statistics), offset, size, buf);
+	} else if (vfs_node == frames_node) {
+		Paging_Frames_Statistics statistics;
+		paging_get_frames_statistics(&statistics);
+		return read_statistics(&statistics, sizeof(Paging_Frames_Statistics), offset, size, buf);
+	} else if (vfs_node == zero_pool_node) {
+		Paging_Zero_Pool_Statistics statistics;
+		paging_get_zero_pool_statistics(&statistics);
+		return read_statistics(&statistics, sizeof(Paging_Zero_Pool_Statistics), offset, size, buf);
 	}
 	return 0;
 }
@@ -46,6 +85,22 @@ static s32 dev_readdir(Vfs_Node* vfs_node, u32 index, Vfs_Dirent* dirent) {
 		strcpy(dirent->name, KEYBOARD_FILE_NAME);
 		dirent->inode = 2;
 		return 0;
+	} else if (index == 2) {
+		strcpy(dirent->name, KHEAP_FILE_NAME);
+		dirent->inode = 3;
+		return 0;
+	} else if (index == 3) {
+		strcpy(dirent->name, TLB_FILE_NAME);
+		dirent->inode = 4;
+		return 0;
+	} else if (index == 4) {
+		strcpy(dirent->name, FRAMES_FILE_NAME);
+		dirent->inode = 5;
+		return 0;
+	} else if (index == 5) {
+		strcpy(dirent->name, ZERO_POOL_FILE_NAME);
+		dirent->inode = 6;
+		return 0;
 	}
 	return -1;
 }
@@ -56,13 +111,21 @@ static Vfs_Node* dev_lookup(Vfs_Node* vfs_node, const s8* path) {
 			return screen_node;
 		} else if (!strcmp(path, KEYBOARD_FILE_NAME)) {
 			return keyboard_node;
+		} else if (!strcmp(path, KHEAP_FILE_NAME)) {
+			return kheap_node;
+		} else if (!strcmp(path, TLB_FILE_NAME)) {
+			return tlb_node;
+		} else if (!strcmp(path, FRAMES_FILE_NAME)) {
+			return frames_node;
+		} else if (!strcmp(path, ZERO_POOL_FILE_NAME)) {
+			return zero_pool_node;
 		}
 	}
 	return 0;
 }
 
 Vfs_Node* dev_init() {
-	dev_root_node = kalloc_alloc(sizeof(Vfs_Node));
+	dev_root_node = vfs_node_alloc();
 	dev_root_node->flags = VFS_DIRECTORY;
 	strcpy(dev_root_node->name, "dev");
 	dev_root_node->close = 0;
@@ -74,7 +137,7 @@ Vfs_Node* dev_init() {
 	dev_root_node->inode = 0;
 	dev_root_node->size = 0;
 
-	screen_node = kalloc_alloc(sizeof(Vfs_Node));
+	screen_node = vfs_node_alloc();
 	screen_node->flags = VFS_FILE;
 	strcpy(screen_node->name, SCREEN_FILE_NAME);
 	screen_node->close = 0;
@@ -86,7 +149,7 @@ Vfs_Node* dev_init() {
 	screen_node->inode = 0;
 	screen_node->size = 0;
 
-	keyboard_node = kalloc_alloc(sizeof(Vfs_Node));
+	keyboard_node = vfs_node_alloc();
 	keyboard_node->flags = VFS_FILE;
 	strcpy(keyboard_node->name, KEYBOARD_FILE_NAME);
 	keyboard_node->close = 0;
@@ -98,5 +161,53 @@ Vfs_Node* dev_init() {
 	keyboard_node->inode = 0;
 	keyboard_node->size = 0;
 
+	kheap_node = vfs_node_alloc();
+	kheap_node->flags = VFS_FILE;
+	strcpy(kheap_node->name, KHEAP_FILE_NAME);
+	kheap_node->close = 0;
+	kheap_node->open = 0;
+	kheap_node->read = dev_read;
+	kheap_node->write = 0;
+	kheap_node->readdir = 0;
+	kheap_node->lookup = 0;
+	kheap_node->inode = 0;
+	kheap_node->size = sizeof(Kalloc_Heap_Statistics);
+
+	tlb_node = vfs_node_alloc();
+	tlb_node->flags = VFS_FILE;
+	strcpy(tlb_node->name, TLB_FILE_NAME);
+	tlb_node->close = 0;
+	tlb_node->open = 0;
+	tlb_node->read = dev_read;
+	tlb_node->write = 0;
+	tlb_node->readdir = 0;
+	tlb_node->lookup = 0;
+	tlb_node->inode = 0;
+	tlb_node->size = sizeof(Paging_Tlb_Statistics);
+
+	frames_node = vfs_node_alloc();
+	frames_node->flags = VFS_FILE;
+	strcpy(frames_node->name, FRAMES_FILE_NAME);
+	frames_node->close = 0;
+	frames_node->open = 0;
+	frames_node->read = dev_read;
+	frames_node->write = 0;
+	frames_node->readdir = 0;
+	frames_node->lookup = 0;
+	frames_node->inode = 0;
+	frames_node->size = sizeof(Paging_Frames_Statistics);
+
+	zero_pool_node = vfs_node_alloc();
+	zero_pool_node->flags = VFS_FILE;
+	strcpy(zero_pool_node->name, ZERO_POOL_FILE_NAME);
+	zero_pool_node->close = 0;
+	zero_pool_node->open = 0;
+	zero_pool_node->read = dev_read;
+	zero_pool_node->write = 0;
+	zero_pool_node->readdir = 0;
+	zero_pool_node->lookup = 0;
+	zero_pool_node->inode = 0;
+	zero_pool_node->size = sizeof(Paging_Zero_Pool_Statistics);
+
 	return dev_root_node;
 }
\ No newline at end of file
@@ -14,7 +14,7 @@ typedef struct {
 static u32 num_files;
 static u8** initrd_files_data;
 static Vfs_Node* initrd_root_node;
-static Vfs_Node* initrd_files_nodes;
+static Vfs_Node** initrd_files_nodes;
 
 static s32 initrd_read(Vfs_Node* vfs_node, u32 offset, u32 size, void* buf) {
 	if (offset >= vfs_node->size) {
@@ -31,8 +31,8 @@ static s32 initrd_readdir(Vfs_Node* vfs_node, u32 index, Vfs_Dirent* dirent) {
 	if (index >= num_files) {
 		return -1;
 	}
-	strcpy(dirent->name, initrd_files_nodes[index].name);
-	dirent->inode = initrd_files_nodes[index].inode;
+	strcpy(dirent->name, initrd_files_nodes[index]->name);
+	dirent->inode = initrd_files_nodes[index]->inode;
 	return 0;
 }
 
@@ -40,7 +40,7 @@ static Vfs_Node* initrd_lookup(Vfs_Node* vfs_node, const s8* path) {
 	assert(vfs_node == initrd_root_node, "initrd_lookup called for node that is not the root node");
 	if (vfs_node == initrd_root_node) {
 		for (u32 i = 0; i < num_files; ++i) {
-			Vfs_Node* node = &initrd_files_nodes[i];
+			Vfs_Node* node = initrd_files_nodes[i];
 			if (!strcmp(path, node->name)) {
 				return node;
 			}
@@ -58,26 +58,27 @@ Vfs_Node* initrd_init() {
 	Ramdisk_Header* headers = (Ramdisk_Header*)initrd_data;
 	initrd_data += num_files * sizeof(Ramdisk_Header);
 
-	initrd_files_nodes = kalloc_alloc(sizeof(Vfs_Node) * num_files);
+	initrd_files_nodes = kalloc_alloc(sizeof(Vfs_Node*) * num_files);
 	initrd_files_data = kalloc_alloc(sizeof(u8**) * num_files);
 
 	for (u32 i = 0; i < num_files; ++i) {
-		initrd_files_nodes[i].flags = VFS_FILE;
-		strcpy(initrd_files_nodes[i].name, headers[i].file_name);
-		initrd_files_nodes[i].close = 0;
-		initrd_files_nodes[i].open = 0;
-		initrd_files_nodes[i].read = initrd_read;
-		initrd_files_nodes[i].write = 0;
-		initrd_files_nodes[i].readdir = 0;
-		initrd_files_nodes[i].lookup = 0;
-		initrd_files_nodes[i].inode = i + 1;
-		initrd_files_nodes[i].size = headers[i].file_size;
+		initrd_files_nodes[i] = vfs_node_alloc();
+		initrd_files_nodes[i]->flags = VFS_FILE;
+		strcpy(initrd_files_nodes[i]->name, headers[i].file_name);
+		initrd_files_nodes[i]->close = 0;
+		initrd_files_nodes[i]->open = 0;
+		initrd_files_nodes[i]->read = initrd_read;
+		initrd_files_nodes[i]->write = 0;
+		initrd_files_nodes[i]->readdir = 0;
+		initrd_files_nodes[i]->lookup = 0;
+		initrd_files_nodes[i]->inode = i + 1;
+		initrd_files_nodes[i]->size = headers[i].file_size;
 
 		initrd_files_data[i] = initrd_data;
 		initrd_data += headers[i].file_size;
 	}
 
-	initrd_root_node = kalloc_alloc(sizeof(Vfs_Node));
+	initrd_root_node = vfs_node_alloc();
 	initrd_root_node->flags = VFS_DIRECTORY;
 	strcpy(initrd_root_node->name, "initrd");
 	initrd_root_node->close = 0;
@@ -2,12 +2,13 @@
 #include "initrd.h"
 #include "dev.h"
 #include "../util/util.h"
-#include "../alloc/kalloc.h"
+#include "../alloc/kalloc_slab.h"
 #include "../util/printf.h"
 
 #define NUM_ROOT_NODES 2
 Vfs_Node* vfs_root = 0;
 static Vfs_Node* root_nodes[NUM_ROOT_NODES];
+static Kalloc_Slab_Cache vfs_node_cache;
 
 static s32 vfs_root_readdir(Vfs_Node* vfs_node, u32 index, Vfs_Dirent* dirent) {
 	assert(vfs_node == vfs_root, "vfs_root_readdir called for node that is not the root node");
@@ -32,8 +33,18 @@ static Vfs_Node* vfs_root_lookup(Vfs_Node* vfs_node, const s8* path) {
 	return 0;
 }
 
+Vfs_Node* vfs_node_alloc() {
+	return kalloc_slab_alloc(&vfs_node_cache);
+}
+
+void vfs_node_free(Vfs_Node* vfs_node) {
+	kalloc_slab_free(&vfs_node_cache, vfs_node);
+}
+
 void vfs_init() {
-	vfs_root = kalloc_alloc(sizeof(Vfs_Node));
+	kalloc_slab_cache_create(&vfs_node_cache, "vfs_node", sizeof(Vfs_Node));
+
+	vfs_root = vfs_node_alloc();
 	vfs_root->flags = VFS_DIRECTORY;
 	strcpy(vfs_root->name, "");
 	vfs_root->close = 0;
@@ -43,6 +43,8 @@ typedef struct Vfs_Node {
 extern Vfs_Node* vfs_root;
 
 void vfs_init();
+Vfs_Node* vfs_node_alloc();
+void vfs_node_free(Vfs_Node* vfs_node);
 void vfs_close(Vfs_Node* vfs_node);
 void vfs_open(Vfs_Node* vfs_node, u32 flags);
 s32 vfs_read(Vfs_Node* vfs_node, u32 offset, u32 size, void* buf);
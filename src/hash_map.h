@@ -23,7 +23,8 @@ typedef struct {
     Key_Hash_Func key_hash_func;
     void *data;
 } Hash_Map;
-// Creates a hash map. 'initial_capacity' indicates the initial capacity of the hash_map, in number of elements.
+// Creates a hash map. 'initial_capacity' indicates the initial capacity of the hash_map, in number of elements
+// (rounded up to a power of two).
 // 'key_compare_func' and 'key_hash_func' should be provided by the caller.
 // Returns 0 if sucess, -1 otherwise.
 s32 hash_map_create(Hash_Map *hm, u32 initial_capacity, u32 key_size, u32 value_size,
@@ -47,33 +48,51 @@ void hash_map_for_each_entry(Hash_Map *hm, For_Each_Func for_each_func, void *cu
 
 #ifdef HASH_MAP_IMPLEMENT
 
-typedef struct {
-    s32 valid;
-} Hash_Map_Element_Information;
+// Layout of 'data': first the hash of every slot (HASH_MAP_EMPTY_SLOT if the slot is empty), then the entries of every slot,
+// each one with its key followed by its value.
+// Probing only goes through the hashes, which are small and contiguous. The keys are only compared (and the entries only
+// touched) when the hashes match. Since hashes are stored, growing the table and closing the gap left by a delete never
+// need to hash a key again.
+// The capacity is always a power of two, so the home slot of a hash is given by its low bits.
+#define HASH_MAP_EMPTY_SLOT 0
 
-static Hash_Map_Element_Information *get_element_information(Hash_Map *hm, u32 index) {
-    return (Hash_Map_Element_Information *)((u8 *)hm->data +
-                                            index * (sizeof(Hash_Map_Element_Information) + hm->key_size + hm->value_size));
+static u32 *get_hashes(const Hash_Map *hm) {
+    return (u32 *)hm->data;
 }
 
-static void *get_element_key(Hash_Map *hm, u32 index) {
-    Hash_Map_Element_Information *hmei = get_element_information(hm, index);
-    return (u8 *)hmei + sizeof(Hash_Map_Element_Information);
+static void *get_element_key(const Hash_Map *hm, u32 index) {
+    return (u8 *)hm->data + hm->capacity * sizeof(u32) + index * (hm->key_size + hm->value_size);
 }
 
-static void *get_element_value(Hash_Map *hm, u32 index) {
-    Hash_Map_Element_Information *hmei = get_element_information(hm, index);
-    return (u8 *)hmei + sizeof(Hash_Map_Element_Information) + hm->key_size;
+static void *get_element_value(const Hash_Map *hm, u32 index) {
+    return (u8 *)get_element_key(hm, index) + hm->key_size;
 }
 
-static void put_element_key(Hash_Map *hm, u32 index, const void *key) {
-    void *target = get_element_key(hm, index);
-    memcpy(target, key, hm->key_size);
+// Hashes a key. The hash is mixed, because only its low bits pick the home slot and many hash functions (like the identity
+// of an integer) don't spread them well. Never returns HASH_MAP_EMPTY_SLOT.
+static u32 hash_key(const Hash_Map *hm, const void *key) {
+    u32 hash = hm->key_hash_func(key);
+    hash ^= hash >> 16;
+    hash *= 0x45D9F3B;
+    hash ^= hash >> 16;
+    return hash != HASH_MAP_EMPTY_SLOT ? hash : 1;
 }
 
-static void put_element_value(Hash_Map *hm, u32 index, const void *value) {
-    void *target = get_element_value(hm, index);
-    memcpy(target, value, hm->value_size);
+// Looks for a key with the given hash. Returns 1 if it is found, 0 otherwise.
+// '*slot' receives the slot of the key or, if the key is not there, the empty slot where it would be put.
+static s32 find_slot(const Hash_Map *hm, const void *key, u32 hash, u32 *slot) {
+    u32 *hashes = get_hashes(hm);
+    u32 mask = hm->capacity - 1;
+    u32 pos = hash & mask;
+    while (hashes[pos] != HASH_MAP_EMPTY_SLOT) {
+        if (hashes[pos] == hash && hm->key_compare_func(get_element_key(hm, pos), key)) {
+            *slot = pos;
+            return 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+    *slot = pos;
+    return 0;
 }
 
 s32 hash_map_create(Hash_Map *hm, u32 initial_capacity, u32 key_size, u32 value_size,
@@ -82,13 +101,16 @@ s32 hash_map_create(Hash_Map *hm, u32 initial_capacity, u32 key_size, u32 value_
     hm->key_hash_func = key_hash_func;
     hm->key_size = key_size;
     hm->value_size = value_size;
-    hm->capacity = initial_capacity > 0 ? initial_capacity : 1;
+    hm->capacity = 1;
+    while (hm->capacity < initial_capacity) {
+        hm->capacity <<= 1;
+    }
     hm->num_elements = 0;
-    hm->data = kalloc_alloc(hm->capacity * (sizeof(Hash_Map_Element_Information) + key_size + value_size));
-	memset(hm->data, 0, hm->capacity * (sizeof(Hash_Map_Element_Information) + key_size + value_size));
+    hm->data = kalloc_alloc(hm->capacity * (sizeof(u32) + key_size + value_size));
     if (!hm->data) {
         return -1;
     }
+    memset(hm->data, HASH_MAP_EMPTY_SLOT, hm->capacity * sizeof(u32));
     return 0;
 }
 
@@ -99,41 +121,38 @@ void hash_map_destroy(Hash_Map *hm) {
 static s32 hash_map_grow(Hash_Map *hm) {
     Hash_Map old_hm = *hm;
     if (hash_map_create(hm, old_hm.capacity << 1, old_hm.key_size, old_hm.value_size, old_hm.key_compare_func, old_hm.key_hash_func)) {
+        // Keep the old (still valid) table
+        *hm = old_hm;
         return -1;
     }
+    // Keys are unique, so each entry just goes to the first empty slot from its home slot
+    u32 *old_hashes = get_hashes(&old_hm);
+    u32 *hashes = get_hashes(hm);
+    u32 mask = hm->capacity - 1;
     for (u32 pos = 0; pos < old_hm.capacity; ++pos) {
-        Hash_Map_Element_Information *hmei = get_element_information(&old_hm, pos);
-        if (hmei->valid) {
-            void *key = get_element_key(&old_hm, pos);
-            void *value = get_element_value(&old_hm, pos);
-            if (hash_map_put(hm, key, value))
-                return -1;
+        if (old_hashes[pos] != HASH_MAP_EMPTY_SLOT) {
+            u32 slot = old_hashes[pos] & mask;
+            while (hashes[slot] != HASH_MAP_EMPTY_SLOT) {
+                slot = (slot + 1) & mask;
+            }
+            hashes[slot] = old_hashes[pos];
+            memcpy(get_element_key(hm, slot), get_element_key(&old_hm, pos), hm->key_size + hm->value_size);
         }
     }
+    hm->num_elements = old_hm.num_elements;
     hash_map_destroy(&old_hm);
     return 0;
 }
 
 s32 hash_map_put(Hash_Map *hm, const void *key, const void *value) {
-    u32 pos = hm->key_hash_func(key) % hm->capacity;
-    for (;;) {
-        Hash_Map_Element_Information *hmei = get_element_information(hm, pos);
-        if (!hmei->valid) {
-            hmei->valid = 1;
-            put_element_key(hm, pos, key);
-            put_element_value(hm, pos, value);
-            ++hm->num_elements;
-            break;
-        } else {
-            void *element_key = get_element_key(hm, pos);
-            if (hm->key_compare_func(element_key, key)) {
-                put_element_key(hm, pos, key);
-                put_element_value(hm, pos, value);
-                break;
-            }
-        }
-        pos = (pos + 1) % hm->capacity;
+    u32 hash = hash_key(hm, key);
+    u32 slot;
+    if (!find_slot(hm, key, hash, &slot)) {
+        get_hashes(hm)[slot] = hash;
+        ++hm->num_elements;
     }
+    memcpy(get_element_key(hm, slot), key, hm->key_size);
+    memcpy(get_element_value(hm, slot), value, hm->value_size);
     if ((hm->num_elements << 1) > hm->capacity) {
         if (hash_map_grow(hm)) {
             return -1;
@@ -143,73 +162,46 @@ s32 hash_map_put(Hash_Map *hm, const void *key, const void *value) {
 }
 
 s32 hash_map_get(Hash_Map *hm, const void *key, void *value) {
-    u32 pos = hm->key_hash_func(key) % hm->capacity;
-    for (;;) {
-        Hash_Map_Element_Information *hmei = get_element_information(hm, pos);
-        if (hmei->valid) {
-            void *possible_key = get_element_key(hm, pos);
-            if (hm->key_compare_func(possible_key, key)) {
-                void *entry_value = get_element_value(hm, pos);
-                memcpy(value, entry_value, hm->value_size);
-                return 0;
-            }
-        } else {
-            return -1;
-        }
-        pos = (pos + 1) % hm->capacity;
+    u32 slot;
+    if (!find_slot(hm, key, hash_key(hm, key), &slot)) {
+        return -1;
     }
+    memcpy(value, get_element_value(hm, slot), hm->value_size);
+    return 0;
 }
 
+// Moves entries back into the gap left by a delete, so that every entry can still be reached from its home slot.
 static void adjust_gap(Hash_Map *hm, u32 gap_index) {
-    u32 pos = (gap_index + 1) % hm->capacity;
-    for (;;) {
-        Hash_Map_Element_Information *current_hmei = get_element_information(hm, pos);
-        if (!current_hmei->valid) {
-            break;
-        }
-        void *current_key = get_element_key(hm, pos);
-        u32 hash_position = hm->key_hash_func(current_key) % hm->capacity;
-        u32 normalized_gap_index = (gap_index < hash_position) ? gap_index + hm->capacity : gap_index;
-        u32 normalized_pos = (pos < hash_position) ? pos + hm->capacity : pos;
-        if (normalized_gap_index >= hash_position && normalized_gap_index <= normalized_pos) {
-            void *current_value = get_element_value(hm, pos);
-            current_hmei->valid = 0;
-            Hash_Map_Element_Information *gap_hmei = get_element_information(hm, gap_index);
-            put_element_key(hm, gap_index, current_key);
-            put_element_value(hm, gap_index, current_value);
-            gap_hmei->valid = 1;
+    u32 *hashes = get_hashes(hm);
+    u32 mask = hm->capacity - 1;
+    for (u32 pos = (gap_index + 1) & mask; hashes[pos] != HASH_MAP_EMPTY_SLOT; pos = (pos + 1) & mask) {
+        // The entry can fill the gap if the gap is between its home slot and its slot (going around the end of the table)
+        u32 hash_position = hashes[pos] & mask;
+        if (((gap_index - hash_position) & mask) <= ((pos - hash_position) & mask)) {
+            hashes[gap_index] = hashes[pos];
+            memcpy(get_element_key(hm, gap_index), get_element_key(hm, pos), hm->key_size + hm->value_size);
+            hashes[pos] = HASH_MAP_EMPTY_SLOT;
             gap_index = pos;
         }
-        pos = (pos + 1) % hm->capacity;
     }
 }
 
 s32 hash_map_delete(Hash_Map *hm, const void *key) {
-    u32 pos = hm->key_hash_func(key) % hm->capacity;
-    for (;;) {
-        Hash_Map_Element_Information *hmei = get_element_information(hm, pos);
-        if (hmei->valid) {
-            void *possible_key = get_element_key(hm, pos);
-            if (hm->key_compare_func(possible_key, key)) {
-                hmei->valid = 0;
-                adjust_gap(hm, pos);
-                --hm->num_elements;
-                return 0;
-            }
-        } else {
-            return -1;
-        }
-        pos = (pos + 1) % hm->capacity;
+    u32 slot;
+    if (!find_slot(hm, key, hash_key(hm, key), &slot)) {
+        return -1;
     }
+    get_hashes(hm)[slot] = HASH_MAP_EMPTY_SLOT;
+    adjust_gap(hm, slot);
+    --hm->num_elements;
+    return 0;
 }
 
 void hash_map_for_each_entry(Hash_Map *hm, For_Each_Func for_each_func, void *custom_data) {
+    u32 *hashes = get_hashes(hm);
     for (u32 pos = 0; pos < hm->capacity; ++pos) {
-        Hash_Map_Element_Information *hmei = get_element_information(hm, pos);
-        if (hmei->valid) {
-            void *key = get_element_key(hm, pos);
-            void *value = get_element_value(hm, pos);
-            for_each_func(key, value, custom_data);
+        if (hashes[pos] != HASH_MAP_EMPTY_SLOT) {
+            for_each_func(get_element_key(hm, pos), get_element_value(hm, pos), custom_data);
         }
     }
 }
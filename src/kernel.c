@@ -16,7 +16,9 @@
 #include "gdt.h"
 #include "syscall.h"
 #include "asm/process.h"
+#include "asm/util.h"
 #include "rawx.h"
+#include "paging_benchmark.h"
 
 void print_logo() {
 	s8 logo[] =
@@ -57,22 +59,34 @@ void read_folder(Vfs_Node* folder_node) {
 	}
 }
 
-void main() {
-	gdt_init();
-	screen_init();
-	screen_clear();
-	print_logo();
-
-	timer_init();
-	paging_init();
+// Second part of the kernel initialization, which already runs on the kernel stack. Never returns.
+static void main_on_kernel_stack() {
 	kalloc_init(1);
 	interrupt_init();
 	keyboard_init();
 	syscall_init();
 	vfs_init();
 
+#ifdef BOOT_BENCHMARKS_ENABLED
+	paging_benchmark_run();
+#endif
+
 	printf("Kernel initialization completed.\n");
 	printf("Starting processes and switching to user-mode...\n");
 
 	process_init();
+}
+
+void main() {
+	gdt_init();
+	screen_init();
+	screen_clear();
+	print_logo();
+
+	timer_init();
+	paging_init((const E820_Memory_Map*)E820_MEMORY_MAP_ADDRESS);
+
+	// So far we were running on the boot stack. Now that paging is enabled, the kernel stack is mapped.
+	// Interrupts are only enabled by 'interrupt_init', so nothing else is using the boot stack at this point.
+	util_switch_stack_and_call(KERNEL_STACK_ADDRESS, main_on_kernel_stack);
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "util/printf.h"
 #include "alloc/kalloc.h"
 #include "process.h"
+#include "asm/process.h"
+#include "timer.h"
 
 // Each x86 page has 4KB (default)
 // Each page table also has 4KB. Each page table entry occupies 4 bytes (32 bits). Therefore, a single page table can
@@ -20,6 +22,20 @@
 
 	0xC0000000    | Start of Stack
 	              | Stack Space
+	----------    | Free Space
+	0x40000000    |
+	              | Temporary Mappings
+	0x3FC00000    |
+	              | Page Tables and Page Directories
+	0x38000000    |
+	----------    | Free Space
+	0x38000000    |
+	              | Slabs (see kalloc_slab.h)
+	0x34000000    |
+	----------    | Free Space
+	0x30180000    |
+	              | Frame Reference Counts
+	0x30000000    |
 	----------    | Free Space
 	              | Heap Space
 	0x00500000    | Start of Heap
@@ -29,13 +45,63 @@
     0x000C0000    |
 	              | Reserved for Video Memory
     0x000A0000    |
+	              | Not Used
+    0x00090000    |
+	              | Boot Stack (only used until paging is enabled)
+    0x00080000    |
 	              | Reserved for Kernel Code + Kernel Data
 	0x00000000    |
 */
 
-u8 available_frames_bitmap_data[AVAILABLE_FRAMES_NUM / 8];
+// Biggest block of page table memory, in pages (page directories need more than one page)
+#define PAGE_TABLE_MEMORY_MAX_PAGES 4
+#define PAGE_DIRECTORY_PAGES ((sizeof(Page_Directory) + 0xFFF) / 0x1000)
+
+// A range of adjacent pages that must be invalidated from the TLB
+typedef struct {
+	u32 first_page_num;
+	u32 num_pages;
+} Tlb_Pending_Range;
+
+// Invalidations are not done right away. They wait here until 'paging_tlb_flush' is called, so adjacent pages
+// are batched and, if there are too many of them, a single full flush is done instead.
 typedef struct {
+	Tlb_Pending_Range ranges[PAGING_TLB_MAX_PENDING_RANGES];
+	u32 num_ranges;
+	u32 num_pages;
+	s32 full_flush_needed;
+	// If set, at least one of the pages is global, so reloading CR3 is not enough to flush it
+	s32 global_pages_involved;
+	Paging_Tlb_Statistics statistics;
+} Tlb;
+
+// Frames that were already zeroed in the background, so allocations that need zeroed memory don't have to wait for it.
+// Frames in the pool are set in 'available_frames' and have a single reference.
+typedef struct {
+	u32 frames[PAGING_ZERO_POOL_CAPACITY];
+	Paging_Zero_Pool_Statistics statistics;
+} Zero_Pool;
+
+// Page tables and page directories must be aligned to 0x1000 (physically), so they are not taken from the heap, where
+// they would leave alignment padding everywhere. Instead, they get whole pages of their own part of the kernel address space.
+// Freed blocks keep their frames and wait in a free list (by number of pages) to be reused.
+typedef struct {
+	u32 next_addr;												// Pages from this address on were never used
+	void* free_blocks[PAGE_TABLE_MEMORY_MAX_PAGES + 1];		// The first word of each free block points to the next one
+} Page_Table_Memory;
+
+typedef struct {
+	// Only frames below 'num_frames' are tracked. Frames that are not usable RAM (according to the BIOS) are always set.
 	Bitmap available_frames;
+	u32 num_frames;
+	// How many pages are mapped to each frame. Frames are shared between address spaces after a fork (copy-on-write).
+	// Frames allocated before the reference counts are mapped (i.e. during paging_init) have a reference count of 0.
+	u16* frame_reference_counts;
+	// The frame address currently mapped to each temporary mapping slot (0 if none)
+	u32 temporary_mapping_frames[TEMPORARY_MAPPING_SLOTS];
+	Tlb tlb;
+	Zero_Pool zero_pool;
+	Page_Table_Memory page_table_memory;
 	Page_Directory* kernel_page_directory;
 } Paging;
 
@@ -52,55 +118,30 @@ u32 final_kernel_code_data_addr = (u32)&end;
 /* PRE-PAGING FUNCTIONS */
 /* ******************** */
 
-static void create_pre_paging_mapping(u32 page_num, u32 frame_num);
-
+// THIS FUNCTION SHOULD ONLY BE USED BEFORE PAGING IS ENABLED.
+// Creates a kernel page table. Its physical address is equal to its virtual address, which is under the reserved space that
+// we have for page tables in the kernel address space (see KERNEL_PAGE_TABLES_ADDRESS). That space is part of the first
+// 4MB page, which is identity mapped, so the 'tables[*]' pointer is valid both before and after paging is enabled.
 static void create_pre_paging_page_table(u32 page_table_index) {
-	// The page address. Serves for both virtual and physical address, since we are using an identity map.
 	u32 page_address = KERNEL_PAGE_TABLES_ADDRESS + page_table_index * 0x1000;
-	// The page number. Serves for both virtual and physical page, since we are using an identity map.
-	u32 page_num = page_address / 0x1000;
 	paging.kernel_page_directory->tables[page_table_index] = (Page_Table*)page_address;
 	paging.kernel_page_directory->tables_x86_representation[page_table_index] = (u32)(paging.kernel_page_directory->tables[page_table_index]) | 0x7; // PRESENT, RW, US
 
 	memset(paging.kernel_page_directory->tables[page_table_index], 0, sizeof(Page_Table));
-
-	// The new page table also needs a frame... In this case we call this function recursively, mapping the just configured
-	// virtual address to its corresponding physical address (they are equal)
-	// The recursive call will create the frame (i.e. set the bitmap and configure the page entry in the page table that
-	// will contain the frame of the page table that we are currently creating :))
-	// Note that we can have a recursive call with depth even more bigger.
-	create_pre_paging_mapping(page_num, page_num);
-
-	printf("Allocating new table %u\n", page_table_index);
 }
 
 // THIS FUNCTION SHOULD ONLY BE USED BEFORE PAGING IS ENABLED.
-// This function maps a given page (page_num) to a given frame (frame_num).
-// The page entry and page table will be prepared for when paging is enabled.
-// If a page table needs to be created, its virtual address will be already the correct one (it will be under the 
-// reserved space that we have for page tables in the kernel address space)
-// The physical address of the page table, however, will be *EQUAL TO ITS VIRTUAL ADDRESS*. In other words, we are using an identity map.
-// We do that because if we were to pick the first frame available in the bitmap, we could pick a frame that will be needed in the future for the
-// identity maps that needs to be created when paging is enabled. (e.g. the kernel code/data)
-// Using an identity map for the page tables here is also helpful because the page_directory->tables[*] pointer will be valid both before and after
-// paging is enabled, since the physical address is equal to the virtual address.
-// Note that this function assumes that all the physical addresses that fall under the address range reserved for page tables
-// (in the kernel virtual address space) are free and can be used freely (because, again, we are using an identity map).
-static void create_pre_paging_mapping(u32 page_num, u32 frame_num) {
-	u32 page_table_index = page_num / 1024;
-	u32 page_num_within_table = page_num % 1024;
-
-	if (!paging.kernel_page_directory->tables[page_table_index]) {
-		create_pre_paging_page_table(page_table_index);
+// Maps a whole page table worth of pages (4MB) to 1024 contiguous frames, using a single 4MB page.
+// 'frame_num' must be 4MB aligned (multiple of 1024). The frames must already be marked as used by the caller.
+static void create_pre_paging_large_mapping(u32 page_table_index, u32 frame_num) {
+	assert(frame_num % 1024 == 0, "Large pages must be 4MB aligned, but got frame %u (0x%x)!", frame_num, frame_num * 0x1000);
+	assert(!paging.kernel_page_directory->tables_x86_representation[page_table_index], "Page table %u already exists!", page_table_index);
+
+	u32 page_directory_entry = frame_num * 0x1000 | PAGE_DIRECTORY_ENTRY_PRESENT | PAGE_DIRECTORY_ENTRY_WRITABLE | PAGE_DIRECTORY_ENTRY_LARGE;
+	if (page_table_index * 0x400000 < KERNEL_ADDRESS_SPACE_END) {
+		page_directory_entry |= PAGE_DIRECTORY_ENTRY_GLOBAL;
 	}
-
-	Page_Entry* page_entry = &paging.kernel_page_directory->tables[page_table_index]->pages[page_num_within_table];
-	memset(page_entry, 0, sizeof(Page_Entry));
-	bitmap_set(&paging.available_frames, frame_num);
-	page_entry->present = 1;
-	page_entry->user_mode = 0;  // kernel-mode pages
-	page_entry->writable = 1;   // for now all pages are writable
-	page_entry->frame_address_20_bits = frame_num;
+	paging.kernel_page_directory->tables_x86_representation[page_table_index] = page_directory_entry;
 }
 
 // Reserve space after the end of the kernel code+data memory segment.
@@ -108,6 +149,7 @@ static void create_pre_paging_mapping(u32 page_num, u32 frame_num) {
 static void* reserve_pre_paging_space(u32 size) {
 	void* addr = (void*)final_kernel_code_data_addr;
 	final_kernel_code_data_addr += size;
+	assert(final_kernel_code_data_addr <= BOOT_STACK_LIMIT, "Pre-paging space reached the boot stack!");
 	memset(addr, 0, size);
 	return addr;
 }
@@ -121,10 +163,431 @@ static void* reserve_pre_paging_aligned_space(u32 size) {
 	}
 	void* addr = (void*)final_kernel_code_data_addr;
 	final_kernel_code_data_addr += size;
+	assert(final_kernel_code_data_addr <= BOOT_STACK_LIMIT, "Pre-paging space reached the boot stack!");
 	memset(addr, 0, size);
 	return addr;
 }
 
+// Marks all frames in [base, base + length) as used (if 'used' is set) or free.
+// Free ranges are shrunk to whole frames, while used ranges are extended to whole frames.
+static void set_frames_from_memory_map_entry(u64 base, u64 length, s32 used) {
+	u64 end = base + length;
+	if (end > paging.num_frames * 0x1000ULL) {
+		end = paging.num_frames * 0x1000ULL;
+	}
+	if (base >= end) {
+		return;
+	}
+
+	u32 first_frame = used ? (u32)(base / 0x1000) : (u32)((base + 0xFFF) / 0x1000);
+	u32 last_frame = used ? (u32)((end + 0xFFF) / 0x1000) : (u32)(end / 0x1000);
+	for (u32 i = first_frame; i < last_frame; ++i) {
+		if (used) {
+			bitmap_set(&paging.available_frames, i);
+		} else {
+			bitmap_clear(&paging.available_frames, i);
+		}
+	}
+}
+
+// Creates the bitmap of available frames, based on the BIOS memory map.
+// The bitmap only covers RAM up to the last usable frame, and starts with everything set. Then, usable RAM is cleared.
+static void init_available_frames(const E820_Memory_Map* memory_map) {
+	assert(memory_map->num_entries > 0, "The BIOS memory map is empty. Is E820 supported?");
+
+	u32 num_entries = MIN(memory_map->num_entries, E820_MEMORY_MAP_MAX_ENTRIES);
+	u64 usable_ram_end = 0;
+	u64 usable_ram_size = 0;
+	for (u32 i = 0; i < num_entries; ++i) {
+		const E820_Entry* entry = &memory_map->entries[i];
+		if (entry->type == E820_TYPE_USABLE) {
+			usable_ram_end = MAX(usable_ram_end, entry->base + entry->length);
+			usable_ram_size += entry->length;
+		}
+	}
+	if (usable_ram_end > PHYSICAL_RAM_SIZE) {
+		usable_ram_end = PHYSICAL_RAM_SIZE;
+	}
+
+	// The bitmap is scanned one word at a time, so we round the number of frames up to a multiple of 32.
+	paging.num_frames = (u32)(usable_ram_end / 0x1000);
+	paging.num_frames = (paging.num_frames + 31) & ~31;
+	u32 bitmap_size = paging.num_frames / 8;
+	u32 summary_size = ((bitmap_size / 4 + 31) / 32) * 4;
+	u8* bitmap_data = reserve_pre_paging_aligned_space(bitmap_size);
+	u32* bitmap_summary = reserve_pre_paging_space(summary_size);
+	memset(bitmap_data, 0xFF, bitmap_size);
+	bitmap_init(&paging.available_frames, bitmap_data, bitmap_size, bitmap_summary);
+
+	for (u32 i = 0; i < num_entries; ++i) {
+		const E820_Entry* entry = &memory_map->entries[i];
+		if (entry->type == E820_TYPE_USABLE) {
+			set_frames_from_memory_map_entry(entry->base, entry->length, 0);
+		}
+	}
+	// BIOSes may report overlapping entries. In this case, the reserved entry wins.
+	for (u32 i = 0; i < num_entries; ++i) {
+		const E820_Entry* entry = &memory_map->entries[i];
+		if (entry->type != E820_TYPE_USABLE) {
+			set_frames_from_memory_map_entry(entry->base, entry->length, 1);
+		}
+	}
+
+	printf("Usable RAM: %u KB. Tracking %u frames.\n", (u32)(usable_ram_size / 1024), paging.num_frames);
+}
+
+/* ******************** */
+
+// Allocates a frame. The frame starts with a single reference.
+static u32 allocate_frame() {
+	u32 allocd_frame = bitmap_get_first_clear(&paging.available_frames);
+	bitmap_set(&paging.available_frames, allocd_frame);
+	if (paging.frame_reference_counts) {
+		paging.frame_reference_counts[allocd_frame] = 1;
+	}
+	return allocd_frame;
+}
+
+// Drops one reference to a frame. The frame is only freed when its last reference goes away.
+static void release_frame(u32 frame) {
+	assert(paging.frame_reference_counts[frame] > 0, "Trying to release frame 0x%x, but it has no references!", frame * 0x1000);
+	--paging.frame_reference_counts[frame];
+	if (paging.frame_reference_counts[frame] == 0) {
+		bitmap_clear(&paging.available_frames, frame);
+	}
+}
+
+/* ******************** */
+/*         TLB          */
+/* ******************** */
+
+static s32 is_page_directory_active(const Page_Directory* page_directory) {
+	Page_Directory* active_page_directory = process_get_active_page_directory();
+	if (!active_page_directory) {
+		active_page_directory = paging.kernel_page_directory;
+	}
+	return page_directory == active_page_directory;
+}
+
+// Invalidates a single page right away
+static void invalidate_page(u32 page_num) {
+	paging_invalidate_page(page_num * 0x1000);
+	++paging.tlb.statistics.page_invalidations;
+}
+
+// Schedules the invalidation of a page whose entry was changed (or removed).
+// Nothing happens until 'paging_tlb_flush' is called. Pages of inactive page directories are ignored, since their
+// entries will be dropped anyway when switching to them (unless they are kernel pages, which are global).
+void paging_tlb_invalidate_page(const Page_Directory* page_directory, u32 page_num) {
+	s32 is_global = page_num < KERNEL_ADDRESS_SPACE_END / 0x1000;
+	if (!is_global && !is_page_directory_active(page_directory)) {
+		return;
+	}
+
+	Tlb* tlb = &paging.tlb;
+	tlb->global_pages_involved |= is_global;
+	++tlb->num_pages;
+	if (tlb->full_flush_needed) {
+		return;
+	}
+	if (tlb->num_pages > PAGING_TLB_INVALIDATION_THRESHOLD) {
+		tlb->full_flush_needed = 1;
+		return;
+	}
+
+	if (tlb->num_ranges > 0) {
+		Tlb_Pending_Range* last_range = &tlb->ranges[tlb->num_ranges - 1];
+		if (page_num == last_range->first_page_num + last_range->num_pages) {
+			++last_range->num_pages;
+			return;
+		}
+	}
+	if (tlb->num_ranges == PAGING_TLB_MAX_PENDING_RANGES) {
+		tlb->full_flush_needed = 1;
+		return;
+	}
+	tlb->ranges[tlb->num_ranges].first_page_num = page_num;
+	tlb->ranges[tlb->num_ranges].num_pages = 1;
+	++tlb->num_ranges;
+}
+
+// Performs all pending invalidations
+void paging_tlb_flush() {
+	Tlb* tlb = &paging.tlb;
+	if (tlb->full_flush_needed) {
+		if (tlb->global_pages_involved) {
+			paging_tlb_flush_all();
+		} else {
+			process_flush_tlb();
+			++tlb->statistics.full_flushes;
+		}
+	} else {
+		for (u32 i = 0; i < tlb->num_ranges; ++i) {
+			for (u32 j = 0; j < tlb->ranges[i].num_pages; ++j) {
+				invalidate_page(tlb->ranges[i].first_page_num + j);
+			}
+		}
+	}
+
+	tlb->num_ranges = 0;
+	tlb->num_pages = 0;
+	tlb->full_flush_needed = 0;
+	tlb->global_pages_involved = 0;
+}
+
+// Flushes the whole TLB, including global pages. Toggling CR4.PGE is the way to drop global entries.
+void paging_tlb_flush_all() {
+	paging_set_global_pages(0);
+	paging_set_global_pages(1);
+	++paging.tlb.statistics.full_flushes;
+}
+
+void paging_get_tlb_statistics(Paging_Tlb_Statistics* statistics) {
+	*statistics = paging.tlb.statistics;
+	statistics->uptime_seconds = timer_get_uptime_seconds();
+}
+
+/* ******************** */
+
+static s32 is_large_page(const Page_Directory* page_directory, u32 page_table_index) {
+	return (page_directory->tables_x86_representation[page_table_index] & PAGE_DIRECTORY_ENTRY_LARGE) != 0;
+}
+
+// Returns the page entry that a 4KB page would have if the 4MB page that it is part of was made of a page table
+static Page_Entry get_page_entry_of_large_page(const Page_Directory* page_directory, u32 page_num) {
+	u32 page_directory_entry = page_directory->tables_x86_representation[page_num / 1024];
+	Page_Entry page_entry;
+	memset(&page_entry, 0, sizeof(Page_Entry));
+	page_entry.present = 1;
+	page_entry.writable = (page_directory_entry & PAGE_DIRECTORY_ENTRY_WRITABLE) != 0;
+	page_entry.user_mode = (page_directory_entry & PAGE_DIRECTORY_ENTRY_USER_MODE) != 0;
+	page_entry.global = (page_directory_entry & PAGE_DIRECTORY_ENTRY_GLOBAL) != 0;
+	page_entry.frame_address_20_bits = (page_directory_entry & PAGE_DIRECTORY_ENTRY_LARGE_FRAME_MASK) / 0x1000 + page_num % 1024;
+	return page_entry;
+}
+
+/* ******************** */
+/*  CONTIGUOUS FRAMES   */
+/* ******************** */
+
+// Allocates 2^order physically contiguous frames, straight from the bitmap of available frames. The first frame is aligned
+// to 2^order frames. Blocks are rare (e.g. the 4MB pages of the boot kernel stack), so nothing is kept aside for them:
+// frames that are not part of a block are always available to 'allocate_frame'.
+// Returns the physical address of the first frame, or 0 if there is no contiguous run available.
+u32 paging_alloc_frames(u32 order) {
+	assert(order <= PAGING_MAX_FRAMES_ORDER, "Order %u is too big (max is %u)", order, PAGING_MAX_FRAMES_ORDER);
+	u32 frame;
+	if (bitmap_find_clear_aligned_range(&paging.available_frames, 1 << order, &frame)) {
+		return 0;
+	}
+	for (u32 i = 0; i < (1u << order); ++i) {
+		bitmap_set(&paging.available_frames, frame + i);
+		// Blocks allocated before the reference counts are mapped (i.e. during paging_init) have no references
+		if (paging.frame_reference_counts) {
+			paging.frame_reference_counts[frame + i] = 1;
+		}
+	}
+	return frame * 0x1000;
+}
+
+// Frees 2^order frames that were allocated via 'paging_alloc_frames'.
+void paging_free_frames(u32 frame_addr, u32 order) {
+	u32 frame = frame_addr / 0x1000;
+	assert(order <= PAGING_MAX_FRAMES_ORDER, "Order %u is too big (max is %u)", order, PAGING_MAX_FRAMES_ORDER);
+	assert(frame % (1 << order) == 0, "Frame 0x%x is not aligned to order %u", frame_addr, order);
+	for (u32 i = 0; i < (1u << order); ++i) {
+		if (paging.frame_reference_counts) {
+			paging.frame_reference_counts[frame + i] = 0;
+		}
+		bitmap_clear(&paging.available_frames, frame + i);
+	}
+}
+
+// Counts the free blocks of each order by going through the bitmap of available frames one word (32 frames) at a time.
+void paging_get_frames_statistics(Paging_Frames_Statistics* statistics) {
+	// Bits of a word that start a block of 2^order frames (orders 0 to 5, which fit in a single word)
+	static const u32 block_start_masks[] = { 0xFFFFFFFF, 0x55555555, 0x11111111, 0x01010101, 0x00010001, 0x00000001 };
+	memset(statistics, 0, sizeof(Paging_Frames_Statistics));
+	const u32* words = (const u32*)paging.available_frames.data;
+	u32 num_words = paging.available_frames.size / 4;
+	u32 free_words_in_a_row = 0;
+	for (u32 w = 0; w < num_words; ++w) {
+		u32 free_bits = ~words[w];
+		for (u32 order = 0; order <= 5 && order <= PAGING_MAX_FRAMES_ORDER; ++order) {
+			// Bit i of 'block_bits' is set if the frames [i, i + 2^order) are all free
+			u32 block_bits = free_bits;
+			for (u32 shift = 1; shift < (1u << order); shift *= 2) {
+				block_bits &= block_bits >> shift;
+			}
+			// Count the set bits (__builtin_popcount would need libgcc)
+			for (block_bits &= block_start_masks[order]; block_bits; block_bits &= block_bits - 1) {
+				++statistics->free_blocks[order];
+			}
+		}
+		// Bigger blocks are made of whole words
+		free_words_in_a_row = free_bits == 0xFFFFFFFF ? free_words_in_a_row + 1 : 0;
+		for (u32 order = 6; order <= PAGING_MAX_FRAMES_ORDER; ++order) {
+			u32 block_words = 1u << (order - 5);
+			if ((w + 1) % block_words == 0 && free_words_in_a_row >= block_words) {
+				++statistics->free_blocks[order];
+			}
+		}
+	}
+}
+
+/* ******************** */
+
+// Maps a frame to one of the temporary mapping slots and returns the virtual address of the slot.
+// The slots live in the kernel address space, so they are shared by all address spaces. If a process is preempted
+// while using a slot, its mapping is restored when it gets the CPU back (see 'process_switch').
+static void* map_temporary_frame(u32 slot, u32 frame_addr) {
+	u32 page_num = TEMPORARY_MAPPING_ADDRESS / 0x1000 + slot;
+	u32 page_addr = page_num * 0x1000;
+	if (paging.temporary_mapping_frames[slot] != frame_addr) {
+		// The frame is recorded before the page entry is written (hence the volatile accesses): if the process is
+		// preempted in between, 'process_switch' saves the new frame and maps it again when the process resumes.
+		*(volatile u32*)&paging.temporary_mapping_frames[slot] = frame_addr;
+		volatile Page_Entry* page_entry = &paging.kernel_page_directory->tables[page_num / 1024]->pages[page_num % 1024];
+		page_entry->present = 1;
+		page_entry->writable = 1;
+		page_entry->user_mode = 0;
+		page_entry->global = 1;
+		page_entry->frame_address_20_bits = frame_addr >> 12;
+		invalidate_page(page_num);
+	}
+	return (void*)page_addr;
+}
+
+void paging_get_temporary_mappings(u32 frame_addrs[TEMPORARY_MAPPING_SLOTS]) {
+	for (u32 i = 0; i < TEMPORARY_MAPPING_SLOTS; ++i) {
+		frame_addrs[i] = paging.temporary_mapping_frames[i];
+	}
+}
+
+void paging_restore_temporary_mappings(const u32 frame_addrs[TEMPORARY_MAPPING_SLOTS]) {
+	for (u32 i = 0; i < TEMPORARY_MAPPING_SLOTS; ++i) {
+		if (frame_addrs[i]) {
+			map_temporary_frame(i, frame_addrs[i]);
+		}
+	}
+}
+
+// Copies one frame (4KB) to another, without disabling paging.
+void paging_copy_frame(u32 frame_dst_addr, u32 frame_src_addr) {
+	void* dst = map_temporary_frame(0, frame_dst_addr);
+	void* src = map_temporary_frame(1, frame_src_addr);
+	paging_copy_page(dst, src);
+}
+
+// Compares one frame (4KB) to another, without disabling paging.
+// Returns 0 if they are equal, 1 otherwise.
+s32 paging_compare_frame(u32 frame1_addr, u32 frame2_addr) {
+	void* page1 = map_temporary_frame(0, frame1_addr);
+	void* page2 = map_temporary_frame(1, frame2_addr);
+	return paging_compare_page(page1, page2);
+}
+
+// Zeroes one frame (4KB), without disabling paging.
+void paging_zero_frame(u32 frame_addr) {
+	void* page = map_temporary_frame(0, frame_addr);
+	paging_zero_page(page);
+}
+
+/* ******************** */
+/*      ZERO POOL       */
+/* ******************** */
+
+// Allocates a frame whose contents are all zeroes. The frame starts with a single reference.
+static u32 allocate_zeroed_frame() {
+	Zero_Pool* zero_pool = &paging.zero_pool;
+	if (zero_pool->statistics.frames > 0) {
+		++zero_pool->statistics.hits;
+		return zero_pool->frames[--zero_pool->statistics.frames];
+	}
+	++zero_pool->statistics.misses;
+	u32 allocd_frame = allocate_frame();
+	paging_zero_frame(allocd_frame * 0x1000);
+	return allocd_frame;
+}
+
+// Zeroes up to 'max_frames' new frames and adds them to the zero pool, until the pool is full.
+// This is meant to be called when nothing else is using the temporary mappings (i.e. when interrupting user-mode code).
+void paging_zero_pool_refill(u32 max_frames) {
+	Zero_Pool* zero_pool = &paging.zero_pool;
+	// The pool can only be used once frames are reference counted
+	if (!paging.frame_reference_counts) {
+		return;
+	}
+	for (u32 i = 0; i < max_frames && zero_pool->statistics.frames < PAGING_ZERO_POOL_CAPACITY; ++i) {
+		u32 allocd_frame = allocate_frame();
+		paging_zero_frame(allocd_frame * 0x1000);
+		zero_pool->frames[zero_pool->statistics.frames++] = allocd_frame;
+		++zero_pool->statistics.refills;
+	}
+}
+
+void paging_get_zero_pool_statistics(Paging_Zero_Pool_Statistics* statistics) {
+	*statistics = paging.zero_pool.statistics;
+}
+
+void paging_print_zero_pool_statistics() {
+	Paging_Zero_Pool_Statistics* statistics = &paging.zero_pool.statistics;
+	printf("Zero pool: %u/%u frames, %u hits, %u misses, %u frames zeroed in the background\n", statistics->frames,
+		PAGING_ZERO_POOL_CAPACITY, statistics->hits, statistics->misses, statistics->refills);
+}
+
+/* ******************** */
+/*  PAGE TABLE MEMORY   */
+/* ******************** */
+
+static u32 get_page_table_memory_frame_address(u32 addr) {
+	u32 page_num = addr / 0x1000;
+	return paging.kernel_page_directory->tables[page_num / 1024]->pages[page_num % 1024].frame_address_20_bits * 0x1000;
+}
+
+// Allocates 'num_pages' zeroed pages for page tables or page directories. Each page has its own frame, so the block is
+// contiguous in virtual memory only. The frame address of the first page is returned in 'frame_address' (if not 0).
+static void* allocate_page_table_memory(u32 num_pages, u32* frame_address) {
+	Page_Table_Memory* page_table_memory = &paging.page_table_memory;
+	assert(num_pages > 0 && num_pages <= PAGE_TABLE_MEMORY_MAX_PAGES, "Invalid number of page table pages (%u)!", num_pages);
+
+	void* block = page_table_memory->free_blocks[num_pages];
+	if (block) {
+		page_table_memory->free_blocks[num_pages] = *(void**)block;
+		memset(block, 0, num_pages * 0x1000);
+	} else {
+		if (!page_table_memory->next_addr) {
+			page_table_memory->next_addr = PAGE_TABLE_MEMORY_ADDRESS;
+		}
+		assert(page_table_memory->next_addr + num_pages * 0x1000 <= PAGE_TABLE_MEMORY_END, "Out of page table memory!");
+		block = (void*)page_table_memory->next_addr;
+		// The pages were never used, so the kernel page tables don't have them in the TLB
+		for (u32 i = 0; i < num_pages; ++i) {
+			u32 page_num = page_table_memory->next_addr / 0x1000 + i;
+			Page_Entry* page_entry = &paging.kernel_page_directory->tables[page_num / 1024]->pages[page_num % 1024];
+			page_entry->present = 1;
+			page_entry->writable = 1;
+			page_entry->user_mode = 0;
+			page_entry->global = 1;
+			page_entry->frame_address_20_bits = allocate_zeroed_frame();
+		}
+		page_table_memory->next_addr += num_pages * 0x1000;
+	}
+
+	if (frame_address) {
+		*frame_address = get_page_table_memory_frame_address((u32)block);
+	}
+	return block;
+}
+
+static void free_page_table_memory(void* block, u32 num_pages) {
+	Page_Table_Memory* page_table_memory = &paging.page_table_memory;
+	assert((u32)block >= PAGE_TABLE_MEMORY_ADDRESS && (u32)block < PAGE_TABLE_MEMORY_END && (u32)block % 0x1000 == 0,
+		"Trying to free page table memory that was not allocated as such (0x%x)!", block);
+	*(void**)block = page_table_memory->free_blocks[num_pages];
+	page_table_memory->free_blocks[num_pages] = block;
+}
+
 /* ******************** */
 
 static u32 get_physical_address_of_virtual_address(const Page_Directory* page_directory, u32 virtual_addr) {
@@ -132,150 +595,322 @@ static u32 get_physical_address_of_virtual_address(const Page_Directory* page_di
 	u32 page_offset = virtual_addr % 4096;
 	u32 table_num = page_num / 1024;
 	u32 page_index_within_table = page_num % 1024;
+	if (is_large_page(page_directory, table_num)) {
+		return (page_directory->tables_x86_representation[table_num] & PAGE_DIRECTORY_ENTRY_LARGE_FRAME_MASK) + virtual_addr % 0x400000;
+	}
 	return page_directory->tables[table_num]->pages[page_index_within_table].frame_address_20_bits * 0x1000 + page_offset;
 }
 
 u32 paging_get_page_directory_x86_tables_frame_address(const Page_Directory* page_directory) {
-	return get_physical_address_of_virtual_address(paging.kernel_page_directory, (u32)page_directory)
-		+ OFFSETOF(Page_Directory, tables_x86_representation);
+	return page_directory->tables_x86_representation_frame_address;
 }
 
 u32 paging_get_page_frame_address(const Page_Directory* page_directory, u32 page_num) {
 	return get_physical_address_of_virtual_address(page_directory, page_num * 0x1000);
 }
 
+static s32 page_exist(const Page_Directory* page_directory, u32 page_num) {
+	u32 page_table_index = page_num / 1024;
+	u32 page_num_within_table = page_num % 1024;
+	if (is_large_page(page_directory, page_table_index)) {
+		return 1;
+	}
+	if (page_directory->tables[page_table_index]) {
+		return page_directory->tables[page_table_index]->pages[page_num_within_table].present;
+	}
+	return 0;
+}
+
 static s32 is_page_part_of_kernel_stack_in_process_address_space(u32 page_num) {
-	u32 kernel_stack_in_process_address_space_last_page_num = KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000;
-	u32 kernel_stack_in_process_address_space_first_page_num = kernel_stack_in_process_address_space_last_page_num -
+	u32 kernel_stack_in_process_address_space_last_page_num = KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000 - 1;
+	u32 kernel_stack_in_process_address_space_first_page_num = kernel_stack_in_process_address_space_last_page_num + 1 -
 		KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE;
 	return (page_num >= kernel_stack_in_process_address_space_first_page_num
 		&& page_num <= kernel_stack_in_process_address_space_last_page_num);
 }
 
-void paging_clean_all_non_kernel_pages_from_page_directory(Page_Directory* page_directory) {
-	for (u32 i = 1024 / 4; i < 1024; ++i) {
-		Page_Table* current_table = page_directory->tables[i];
-		// If the page table exists
-		if (current_table) {
-			s32 should_table_be_destroyed = 1;
-			for (u32 j = 0; j < 1024; ++j) {
-				Page_Entry* page_entry = &current_table->pages[j];
-				u32 page_num = i * 1024 + j;
-				if (page_entry->present) {
-					assert(bitmap_get(&paging.available_frames, page_entry->frame_address_20_bits),
-						"Page %u (0x%x) is present, but its frame (0x%x) is not allocd!",
-						page_num, page_num * 0x1000, page_entry->frame_address_20_bits * 0x1000);
-					if (!is_page_part_of_kernel_stack_in_process_address_space(page_num)) {
-						bitmap_clear(&paging.available_frames, page_entry->frame_address_20_bits);
-						memset(page_entry, 0, sizeof(Page_Entry));
-					} else {
-						// We can't destroy this table because there is at least one page that was not destroyed.
-						should_table_be_destroyed = 0;
-					}
+static s32 is_page_table_part_of_kernel_stack_in_process_address_space(u32 page_table_index) {
+	u32 kernel_stack_in_process_address_space_last_page_num = KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000 - 1;
+	u32 kernel_stack_in_process_address_space_first_page_num = kernel_stack_in_process_address_space_last_page_num + 1 -
+		KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE;
+	return (page_table_index >= kernel_stack_in_process_address_space_first_page_num / 1024
+		&& page_table_index <= kernel_stack_in_process_address_space_last_page_num / 1024);
+}
+
+// Adds a page to the regions of a page directory, keeping them sorted and merging adjacent ones.
+// If there is no space for a new region, the closest region is extended to cover the page. This is fine, since regions
+// are allowed to contain pages that are not present.
+static void add_page_to_regions(Page_Directory* page_directory, u32 page_num) {
+	Page_Region* regions = page_directory->regions;
+	u32 i = 0;
+	// Skip all regions that end before the page (and are not adjacent to it)
+	while (i < page_directory->num_regions && regions[i].first_page_num + regions[i].num_pages < page_num) {
+		++i;
+	}
+
+	if (i < page_directory->num_regions) {
+		Page_Region* region = &regions[i];
+		if (page_num >= region->first_page_num && page_num < region->first_page_num + region->num_pages) {
+			return;
+		}
+		if (page_num == region->first_page_num + region->num_pages) {
+			++region->num_pages;
+			// The region might now touch the next one
+			if (i + 1 < page_directory->num_regions && regions[i + 1].first_page_num == page_num + 1) {
+				region->num_pages += regions[i + 1].num_pages;
+				for (u32 j = i + 1; j + 1 < page_directory->num_regions; ++j) {
+					regions[j] = regions[j + 1];
 				}
+				--page_directory->num_regions;
 			}
+			return;
+		}
+		if (page_num + 1 == region->first_page_num) {
+			--region->first_page_num;
+			++region->num_pages;
+			return;
+		}
+	}
+
+	if (page_directory->num_regions == PAGING_MAX_REGIONS) {
+		// Extend the previous or the next region, whichever is closer
+		if (i == PAGING_MAX_REGIONS || (i > 0 && page_num - (regions[i - 1].first_page_num + regions[i - 1].num_pages) <
+			regions[i].first_page_num - page_num)) {
+			regions[i - 1].num_pages = page_num + 1 - regions[i - 1].first_page_num;
+		} else {
+			regions[i].num_pages += regions[i].first_page_num - page_num;
+			regions[i].first_page_num = page_num;
+		}
+		return;
+	}
 
-			if (should_table_be_destroyed) {
-				kalloc_free(current_table);
+	for (u32 j = page_directory->num_regions; j > i; --j) {
+		regions[j] = regions[j - 1];
+	}
+	regions[i].first_page_num = page_num;
+	regions[i].num_pages = 1;
+	++page_directory->num_regions;
+}
+
+// Removes all pages of the process address space (1GB-4GB), except for the kernel stack.
+// Only the regions of the page directory are visited, so the cost depends on how much memory the process has, not on
+// the size of the address space.
+void paging_clean_all_non_kernel_pages_from_page_directory(Page_Directory* page_directory) {
+	for (u32 r = 0; r < page_directory->num_regions; ++r) {
+		Page_Region* region = &page_directory->regions[r];
+		for (u32 page_num = region->first_page_num; page_num < region->first_page_num + region->num_pages; ++page_num) {
+			u32 page_table_index = page_num / 1024;
+
+			Page_Table* current_table = page_directory->tables[page_table_index];
+			if (!current_table) {
+				// Skip to the next page table
+				page_num = page_table_index * 1024 + 1023;
+				continue;
+			}
+
+			Page_Entry* page_entry = &current_table->pages[page_num % 1024];
+			if (page_entry->present && !is_page_part_of_kernel_stack_in_process_address_space(page_num)) {
+				assert(bitmap_get(&paging.available_frames, page_entry->frame_address_20_bits),
+					"Page %u (0x%x) is present, but its frame (0x%x) is not allocd!",
+					page_num, page_num * 0x1000, page_entry->frame_address_20_bits * 0x1000);
+				release_frame(page_entry->frame_address_20_bits);
+				memset(page_entry, 0, sizeof(Page_Entry));
+				paging_tlb_invalidate_page(page_directory, page_num);
+			}
+		}
+	}
+
+	// Every present page belongs to a region, so now the only pages left are the ones of the kernel stack.
+	// All the other page tables that we went through are empty and can be destroyed.
+	for (u32 r = 0; r < page_directory->num_regions; ++r) {
+		Page_Region* region = &page_directory->regions[r];
+		u32 first_page_table_index = region->first_page_num / 1024;
+		u32 last_page_table_index = (region->first_page_num + region->num_pages - 1) / 1024;
+		for (u32 i = first_page_table_index; i <= last_page_table_index; ++i) {
+			if (page_directory->tables[i] && !is_page_table_part_of_kernel_stack_in_process_address_space(i)) {
+				free_page_table_memory(page_directory->tables[i], 1);
 				page_directory->tables[i] = 0;
 				page_directory->tables_x86_representation[i] = 0;
 			}
 		}
 	}
+
+	Vm_Area* vm_area = page_directory->vm_areas;
+	while (vm_area) {
+		Vm_Area* next = vm_area->next;
+		kalloc_free(vm_area);
+		vm_area = next;
+	}
+	page_directory->vm_areas = 0;
+	if (page_directory->vm_image && --page_directory->vm_image->references == 0) {
+		kalloc_free(page_directory->vm_image);
+	}
+	page_directory->vm_image = 0;
+	page_directory->heap_start = 0;
+	page_directory->heap_break = 0;
+	page_directory->heap_limit = 0;
+
+	page_directory->num_regions = 0;
+	for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE; ++i) {
+		u32 page_num = KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000 - 1 - i;
+		if (page_exist(page_directory, page_num)) {
+			add_page_to_regions(page_directory, page_num);
+		}
+	}
+
+	paging_tlb_flush();
+}
+
+// Frees a page directory that was already cleaned by 'paging_clean_all_non_kernel_pages_from_page_directory'. The only
+// pages left are the ones of the kernel stack in the process address space, which are released here aswell.
+// The kernel page tables are shared by all page directories, so they are not touched.
+// The page directory can't be in use: since the kernel stack goes away, this must be called from another address space.
+void paging_free_page_directory(Page_Directory* page_directory) {
+	assert(page_directory != paging.kernel_page_directory, "Trying to free the kernel page directory!");
+	for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE; ++i) {
+		u32 page_num = KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000 - 1 - i;
+		if (page_exist(page_directory, page_num)) {
+			release_frame(page_directory->tables[page_num / 1024]->pages[page_num % 1024].frame_address_20_bits);
+		}
+	}
+	for (u32 i = KERNEL_ADDRESS_SPACE_END / 0x400000; i < 1024; ++i) {
+		if (page_directory->tables[i]) {
+			assert(is_page_table_part_of_kernel_stack_in_process_address_space(i),
+				"Page table %u was not cleaned before freeing the page directory!", i);
+			free_page_table_memory(page_directory->tables[i], 1);
+		}
+	}
+	// The page directory was never active after its pages were released, so there is nothing to invalidate in the TLB.
+	free_page_table_memory(page_directory, PAGE_DIRECTORY_PAGES);
 }
 
 // Clone the page_directory of an existing process.
 // The kernel is always linked to the first 1GB of the address space.
-// The process data, which is part of 1GB-4GB address space range, is copied, not linked.
-Page_Directory* paging_clone_page_directory_for_new_process(const Page_Directory* page_directory) {
-	// x86 demands that the page directory is 0x1000 aligned.
-	// Obvious question is: we are making the virtual address 0x1000 aligned, how does it help with
-	// regards to the physical addr? (which is the one consumed by x86)
-	// Answer: As long as the initial virtual address of our heap is 0x1000 aligned this should work
-	// because the heap will always start by allocating a brand new page, so both virtual address and physical adresses
-	// will always be aligned together.
-	Page_Directory* cloned_page_directory = kalloc_alloc_aligned(sizeof(Page_Directory), 0x1000);
-	memset(cloned_page_directory, 0, sizeof(Page_Directory));
-
-	// @TODO: IMPORTANT: If the kernel creates a new page table, dynamically, we need to add it to all existing address spaces !!!
-
-	// We start by copying all page tables from 1GB to 4GB.
-	for (u32 i = 1024 / 4; i < 1024; ++i) {
-		// If the page table exists
-		if (page_directory->tables[i]) {
-			// x86 demands that the page table is 0x1000 aligned.
-			// Obvious question is: we are making the virtual address 0x1000 aligned, how does it help with
-			// regards to the physical addr? (which is the one consumed by x86)
-			// Answer: As long as the initial virtual address of our heap is 0x1000 aligned this should work
-			// because the heap will always start by allocating a brand new page, so both virtual address and physical adresses
-			// will always be aligned together.
-			Page_Table* copied_page_table = kalloc_alloc_aligned(sizeof(Page_Table), 0x1000);
-			memset(copied_page_table, 0, sizeof(Page_Table));
+// The process data, which is part of 1GB-4GB address space range, is shared copy-on-write: both page directories point
+// to the same frames and writable pages are marked read-only in both of them. The frame is only copied when someone writes
+// to it (see 'page_fault_handler'). The original page directory is modified as well, and its TLB entries are invalidated.
+// There are two exceptions, which are never shared:
+// - The kernel stack in the process address space, because the kernel is running on it (and so is the page fault handler).
+//   The new page directory receives brand new frames for it, and the caller is responsible for filling them.
+// - All pages of the kernel page directory, which are copied (this is how the first process is created).
+Page_Directory* paging_clone_page_directory_for_new_process(Page_Directory* page_directory) {
+	// x86 demands that the page directory is 0x1000 aligned (physically). 'tables_x86_representation' starts at a page
+	// boundary, but the pages of the block don't have contiguous frames, so its frame address is looked up on its own.
+	Page_Directory* cloned_page_directory = allocate_page_table_memory(PAGE_DIRECTORY_PAGES, 0);
+	cloned_page_directory->tables_x86_representation_frame_address =
+		get_page_table_memory_frame_address((u32)cloned_page_directory->tables_x86_representation);
+
+	s32 share_frames = page_directory != paging.kernel_page_directory;
+
+	// We start by copying all pages from 1GB to 4GB. Only the regions of the page directory need to be visited.
+	for (u32 r = 0; r < page_directory->num_regions; ++r) {
+		Page_Region* region = &page_directory->regions[r];
+		for (u32 page_num = region->first_page_num; page_num < region->first_page_num + region->num_pages; ++page_num) {
+			u32 i = page_num / 1024;
+			u32 j = page_num % 1024;
+
+			// 4MB pages are never split. Only the kernel page directory has them (the kernel stack), and their 4KB pages are
+			// copied one at a time, like any other page of the kernel page directory.
+			Page_Entry large_page_entry;
+			if (is_large_page(page_directory, i)) {
+				assert(!share_frames, "Only the kernel page directory can have 4MB pages outside of the kernel address space!");
+				large_page_entry = get_page_entry_of_large_page(page_directory, page_num);
+			} else if (!page_directory->tables[i]) {
+				// Skip to the next page table
+				page_num = i * 1024 + 1023;
+				continue;
+			}
 
-			for (u32 j = 0; j < 1024; ++j) {
-				Page_Entry* current_page_entry = &page_directory->tables[i]->pages[j];
-				if (current_page_entry->present) {
-					// For now, the new page entry receives the same attributes as the one being cloned
-					copied_page_table->pages[j] = *current_page_entry;
-					// Allocate a new frame for the new page
-					u32 allocd_frame = bitmap_get_first_clear(&paging.available_frames);
-					bitmap_set(&paging.available_frames, allocd_frame);
+			if (!cloned_page_directory->tables[i]) {
+				// x86 demands that the page table is 0x1000 aligned (physically), which page table memory always is.
+				u32 copied_page_table_physical_address;
+				Page_Table* copied_page_table = allocate_page_table_memory(1, &copied_page_table_physical_address);
+				// Assign tables 'i' of the new page directory to the table we just created
+				cloned_page_directory->tables[i] = copied_page_table;
+				// Set the tables_x86_representation, expected by x86, to the physical address just calculated (0x7 because user-mode=1)
+				cloned_page_directory->tables_x86_representation[i] = copied_page_table_physical_address | 0x7; // PRESENT, RW, US
+			}
+
+			Page_Table* copied_page_table = cloned_page_directory->tables[i];
+			Page_Entry* current_page_entry = is_large_page(page_directory, i) ? &large_page_entry : &page_directory->tables[i]->pages[j];
+			if (current_page_entry->present && share_frames && !is_page_part_of_kernel_stack_in_process_address_space(page_num)) {
+				// Share the frame with the new page directory
+				u32 frame = current_page_entry->frame_address_20_bits;
+				assert(paging.frame_reference_counts[frame] < 0xFFFF, "Frame 0x%x has too many references!", frame * 0x1000);
+				if (current_page_entry->writable) {
+					current_page_entry->writable = 0;
+					current_page_entry->copy_on_write = 1;
+					paging_tlb_invalidate_page(page_directory, page_num);
+				}
+				copied_page_table->pages[j] = *current_page_entry;
+				++paging.frame_reference_counts[frame];
+			} else if (current_page_entry->present) {
+				// For now, the new page entry receives the same attributes as the one being cloned
+				copied_page_table->pages[j] = *current_page_entry;
+				// Allocate a new frame for the new page. Kernel stack pages of a new process start zeroed (only the part
+				// in use is copied by the fork).
+				u32 allocd_frame = share_frames ? allocate_zeroed_frame() : allocate_frame();
+				// Update the page entry to point to the new frame address
+				copied_page_table->pages[j].frame_address_20_bits = allocd_frame;
+				if (!share_frames) {
 					paging_copy_frame(allocd_frame * 0x1000, current_page_entry->frame_address_20_bits << 12);
-					// Update the page entry to point to the new frame address
-					copied_page_table->pages[j].frame_address_20_bits = allocd_frame;
-					// Force page to be user-mode
+					// Force page to be user-mode (the kernel pages become the pages of the first process)
 					copied_page_table->pages[j].user_mode = 1;
 				}
 			}
-
-			// Assign tables 'i' of the new page directory to the table we just created
-			cloned_page_directory->tables[i] = copied_page_table;
-			// Get the physical address of the table that we just created
-			u32 copied_page_table_physical_address = get_physical_address_of_virtual_address(paging.kernel_page_directory,
-				(u32)copied_page_table);
-			// Set the tables_x86_representation, expected by x86, to the physical address just calculated (0x7 because user-mode=1)
-			cloned_page_directory->tables_x86_representation[i] = copied_page_table_physical_address | 0x7; // PRESENT, RW, US
 		}
 	}
+
+	// The new page directory has the same pages, so it also has the same regions
+	memcpy(cloned_page_directory->regions, page_directory->regions, page_directory->num_regions * sizeof(Page_Region));
+	cloned_page_directory->num_regions = page_directory->num_regions;
+
+	// And the same virtual memory areas. Pages that were not touched yet are created on demand in both.
+	Vm_Area** cloned_vm_area = &cloned_page_directory->vm_areas;
+	for (Vm_Area* vm_area = page_directory->vm_areas; vm_area; vm_area = vm_area->next) {
+		*cloned_vm_area = kalloc_alloc(sizeof(Vm_Area));
+		**cloned_vm_area = *vm_area;
+		cloned_vm_area = &(*cloned_vm_area)->next;
+	}
+	*cloned_vm_area = 0;
+	cloned_page_directory->vm_image = page_directory->vm_image;
+	if (cloned_page_directory->vm_image) {
+		++cloned_page_directory->vm_image->references;
+	}
+	cloned_page_directory->heap_start = page_directory->heap_start;
+	cloned_page_directory->heap_break = page_directory->heap_break;
+	cloned_page_directory->heap_limit = page_directory->heap_limit;
 	
 	// We finish by linking the kernel in the new address space
 	// We link all page tables from 0 to 1024/4, so we account for the first 1GB of the address space.
+	// All of them are created by paging_init and never change, so the new address space will see any new kernel page.
 	for (u32 i = 0; i < 1024 / 4; ++i) {
-		// If the page table exists
-		if (page_directory->tables[i]) {
+		// If the page table exists (or it is a 4MB page)
+		if (page_directory->tables_x86_representation[i]) {
 			// Link (don't copy) the table
 			cloned_page_directory->tables[i] = page_directory->tables[i];
 			cloned_page_directory->tables_x86_representation[i] = page_directory->tables_x86_representation[i];
 		}
 	}
 
+	paging_tlb_flush();
 	return cloned_page_directory;
 }
 
-static s32 page_exist(const Page_Directory* page_directory, u32 page_num) {
-	u32 page_table_index = page_num / 1024;
-	u32 page_num_within_table = page_num % 1024;
-	if (page_directory->tables[page_table_index]) {
-		return page_directory->tables[page_table_index]->pages[page_num_within_table].present;
-	}
-	return 0;
-}
-
-// This function creates a virtual page for a process and allocates a frame to it.
+// Creates a virtual page for a process, pointing to the given frame.
 // Can only be called if the given virtual page is not being used.
-// Returns allocd frame
-u32 paging_create_process_page_with_any_frame(Page_Directory* page_directory, u32 page_num, u32 user_mode) {
+static void create_process_page(Page_Directory* page_directory, u32 page_num, u32 user_mode, u32 frame) {
 	u32 page_table_index = page_num / 1024;
 	u32 page_num_within_table = page_num % 1024;
 
+	assert(!is_large_page(page_directory, page_table_index), "Trying to create page that is part of a 4MB page (%u) (0x%x)!",
+		page_num, page_num * 0x1000);
 	if (!page_directory->tables[page_table_index]) {
-		u32 page_table_virtual_address = (u32)kalloc_alloc_aligned(sizeof(Page_Table), 0x1000);
-		memset((void*)page_table_virtual_address, 0, sizeof(Page_Table));
-		u32 page_table_frame_address = paging_get_page_frame_address(paging.kernel_page_directory, page_table_virtual_address / 0x1000);
+		u32 page_table_frame_address;
+		u32 page_table_virtual_address = (u32)allocate_page_table_memory(1, &page_table_frame_address);
 
 		page_directory->tables[page_table_index] = (Page_Table*)page_table_virtual_address;
 		page_directory->tables_x86_representation[page_table_index] = (u32)(page_table_frame_address) | 0x7; // PRESENT, RW, US
-		memset(page_directory->tables[page_table_index], 0, sizeof(Page_Table));
 
 		printf("Allocating new table %u\n", page_table_index);
 	}
@@ -283,22 +918,30 @@ u32 paging_create_process_page_with_any_frame(Page_Directory* page_directory, u3
 	Page_Entry* page_entry = &page_directory->tables[page_table_index]->pages[page_num_within_table];
 	assert(!page_entry->present, "Trying to create page that already exists (%u) (0x%x)!", page_num, page_num * 0x1000);
 
-	u32 allocd_frame = bitmap_get_first_clear(&paging.available_frames);
-	bitmap_set(&paging.available_frames, allocd_frame);
+	if (page_num >= KERNEL_ADDRESS_SPACE_END / 0x1000) {
+		add_page_to_regions(page_directory, page_num);
+	}
+
 	page_entry->present = 1;
 	page_entry->user_mode = user_mode;
 	page_entry->writable = 1;   // for now all pages are writable
-	page_entry->frame_address_20_bits = allocd_frame;
+	page_entry->frame_address_20_bits = frame;
+}
 
-	// Double-check whether this frame is addressable!
-	// If we pick a physical page that is not addressable (because, for example, it is reserved for MMIO),
-	// then we will not be able to write to this page
-	// ... and it will be extremely hard to debug what is going on :)
-	u8* test = (u8*)(page_num * 0x1000);
-	*test = 0xAB;
-	//printf("Page: %x\n", allocd_frame * 0x1000);
-	assert(*test == 0xAB, "A non-addressable frame was chosen: %u (0x%x)!", allocd_frame, allocd_frame * 0x1000);
+// This function creates a virtual page for a process and allocates a frame to it.
+// Can only be called if the given virtual page is not being used.
+// Returns allocd frame
+u32 paging_create_process_page_with_any_frame(Page_Directory* page_directory, u32 page_num, u32 user_mode) {
+	u32 allocd_frame = allocate_frame();
+	create_process_page(page_directory, page_num, user_mode, allocd_frame);
+	return allocd_frame;
+}
 
+// Same as 'paging_create_process_page_with_any_frame', but the frame is guaranteed to be zeroed.
+// Returns allocd frame
+u32 paging_create_process_page_with_zeroed_frame(Page_Directory* page_directory, u32 page_num, u32 user_mode) {
+	u32 allocd_frame = allocate_zeroed_frame();
+	create_process_page(page_directory, page_num, user_mode, allocd_frame);
 	return allocd_frame;
 }
 
@@ -310,51 +953,360 @@ u32 paging_create_kernel_page_with_any_frame(u32 page_num) {
 	u32 page_table_index = page_num / 1024;
 	u32 page_num_within_table = page_num % 1024;
 
-	if (!page_directory->tables[page_table_index]) {
-		u32 virtual_page_address = KERNEL_PAGE_TABLES_ADDRESS + page_table_index * 0x1000;
-		u32 virtual_page_num = virtual_page_address / 0x1000;
-
-		page_directory->tables[page_table_index] = (Page_Table*)virtual_page_address;
-		// The new page table also needs a frame. Calls this function recursively to get the frame.
-		// @NOTE: The key here is that we know for sure that the page table used to store 'virtual_page_num' will ALWAYS exist.
-		// This is because we always pre-allocate all page tables that may be used to store other page tables.
-		// For this reason, we don't need to worry about the same page-table being referenced multiple times during recursion.
-		u32 allocd_frame = paging_create_kernel_page_with_any_frame(virtual_page_num);
-		u32 page_table_x86_representation = (u32)(allocd_frame * 0x1000) | 0x7; // PRESENT, RW, US
-		page_directory->tables_x86_representation[page_table_index] = page_table_x86_representation;
-		memset(page_directory->tables[page_table_index], 0, sizeof(Page_Table));
-		process_link_kernel_table_to_all_address_spaces(virtual_page_address, page_table_index, page_table_x86_representation);
-
-		printf("Allocating new table %u\n", page_table_index);
-	}
+	// All kernel page tables are created by paging_init, so there is never a page table to create here.
+	assert(page_num < KERNEL_ADDRESS_SPACE_END / 0x1000, "Trying to create kernel page outside of the kernel address space (%u) (0x%x)!",
+		page_num, page_num * 0x1000);
+	assert(page_directory->tables[page_table_index] != 0, "Kernel page table %u was not created!", page_table_index);
 
 	Page_Entry* page_entry = &page_directory->tables[page_table_index]->pages[page_num_within_table];
 	assert(!page_entry->present, "Trying to create page that already exists (%u) (0x%x)!", page_num, page_num * 0x1000);
 
-	u32 allocd_frame = bitmap_get_first_clear(&paging.available_frames);
-	bitmap_set(&paging.available_frames, allocd_frame);
+	u32 allocd_frame = allocate_frame();
 	page_entry->present = 1;
 	page_entry->user_mode = 0;
 	page_entry->writable = 1;   // for now all pages are writable
+	page_entry->global = page_num < KERNEL_ADDRESS_SPACE_END / 0x1000;
 	page_entry->frame_address_20_bits = allocd_frame;
 
-	// Double-check whether this frame is addressable!
-	// If we pick a physical page that is not addressable (because, for example, it is reserved for MMIO),
-	// then we will not be able to write to this page
-	// ... and it will be extremely hard to debug what is going on :)
-	u8* test = (u8*)(page_num * 0x1000);
-	*test = 0xAB;
-	//printf("Page: %x\n", allocd_frame * 0x1000);
-	assert(*test == 0xAB, "A non-addressable frame was chosen: %u (0x%x)!", allocd_frame, allocd_frame * 0x1000);
-
 	return allocd_frame;
 }
 
+// This function removes a virtual page of the kernel and releases its frame.
+// The page is only scheduled for invalidation, so the caller must call 'paging_tlb_flush' before the page is reused.
+void paging_remove_kernel_page(u32 page_num) {
+	Page_Directory* page_directory = paging.kernel_page_directory;
+	u32 page_table_index = page_num / 1024;
+	u32 page_num_within_table = page_num % 1024;
+
+	assert(page_num < KERNEL_ADDRESS_SPACE_END / 0x1000, "Trying to remove kernel page outside of the kernel address space (%u) (0x%x)!",
+		page_num, page_num * 0x1000);
+	assert(page_directory->tables[page_table_index] != 0, "Kernel page table %u was not created!", page_table_index);
+
+	Page_Entry* page_entry = &page_directory->tables[page_table_index]->pages[page_num_within_table];
+	assert(page_entry->present, "Trying to remove page that does not exist (%u) (0x%x)!", page_num, page_num * 0x1000);
+
+	release_frame(page_entry->frame_address_20_bits);
+	memset(page_entry, 0, sizeof(Page_Entry));
+	paging_tlb_invalidate_page(page_directory, page_num);
+}
+
+/* ******************** */
+/* VIRTUAL MEMORY AREAS */
+/* ******************** */
+
+// Returns the page entry of a page, or 0 if the page is not present
+static Page_Entry* find_present_page(const Page_Directory* page_directory, u32 page_num) {
+	Page_Table* page_table = page_directory->tables[page_num / 1024];
+	if (!page_table || !page_table->pages[page_num % 1024].present) {
+		return 0;
+	}
+	return &page_table->pages[page_num % 1024];
+}
+
+static Vm_Area* find_vm_area(const Page_Directory* page_directory, u32 page_num) {
+	for (Vm_Area* vm_area = page_directory->vm_areas; vm_area && vm_area->first_page_num <= page_num; vm_area = vm_area->next) {
+		if (page_num < vm_area->first_page_num + vm_area->num_pages) {
+			return vm_area;
+		}
+	}
+	return 0;
+}
+
+// Applies the protection of a virtual memory area to a page entry
+static void set_page_protection(Page_Entry* page_entry, u32 protection) {
+	page_entry->user_mode = protection != PAGING_PROTECTION_NONE;
+	// A frame that is still shared (e.g. a page that was read-only when the process forked) must not become writable:
+	// the page becomes copy-on-write instead.
+	if ((protection & PAGING_PROTECTION_WRITE) && paging.frame_reference_counts[page_entry->frame_address_20_bits] > 1) {
+		page_entry->copy_on_write = 1;
+	}
+	// Copy-on-write pages stay read-only. They become writable when they are copied (if the area allows it).
+	page_entry->writable = (protection & PAGING_PROTECTION_WRITE) && !page_entry->copy_on_write;
+}
+
+// Makes sure that a virtual memory area starts at 'page_num', splitting the area that contains it (if any)
+static void split_vm_area(Page_Directory* page_directory, u32 page_num) {
+	Vm_Area* vm_area = find_vm_area(page_directory, page_num);
+	if (!vm_area || vm_area->first_page_num == page_num) {
+		return;
+	}
+	u32 data_offset = (page_num - vm_area->first_page_num) * 0x1000;
+	Vm_Area* new_vm_area = kalloc_alloc(sizeof(Vm_Area));
+	new_vm_area->first_page_num = page_num;
+	new_vm_area->num_pages = vm_area->first_page_num + vm_area->num_pages - page_num;
+	new_vm_area->protection = vm_area->protection;
+	new_vm_area->data = vm_area->data_size > data_offset ? vm_area->data + data_offset : 0;
+	new_vm_area->data_size = vm_area->data_size > data_offset ? vm_area->data_size - data_offset : 0;
+	new_vm_area->next = vm_area->next;
+	vm_area->num_pages = page_num - vm_area->first_page_num;
+	vm_area->data_size = MIN(vm_area->data_size, data_offset);
+	vm_area->next = new_vm_area;
+}
+
+// Creates a new virtual memory area and links it after 'previous' (or as the first area if 'previous' is 0)
+static Vm_Area* insert_vm_area(Page_Directory* page_directory, Vm_Area* previous, u32 first_page_num, u32 num_pages,
+	u32 protection) {
+	Vm_Area* vm_area = kalloc_alloc(sizeof(Vm_Area));
+	vm_area->first_page_num = first_page_num;
+	vm_area->num_pages = num_pages;
+	vm_area->protection = protection;
+	vm_area->data = 0;
+	vm_area->data_size = 0;
+	if (previous) {
+		vm_area->next = previous->next;
+		previous->next = vm_area;
+	} else {
+		vm_area->next = page_directory->vm_areas;
+		page_directory->vm_areas = vm_area;
+	}
+	return vm_area;
+}
+
+// Allocates the image that the data of the virtual memory areas of a page directory points into, and returns its data.
+// The image lives as long as the page directory (or any page directory cloned from it) is not cleaned.
+u8* paging_alloc_vm_image(Page_Directory* page_directory, u32 size) {
+	assert(!page_directory->vm_image, "Page directory already has an image, it must be cleaned first!");
+	page_directory->vm_image = kalloc_alloc(sizeof(Vm_Image) + size);
+	page_directory->vm_image->references = 1;
+	return page_directory->vm_image->data;
+}
+
+// Reserves a range of the address space that will be populated on demand, with the first 'data_size' bytes copied from 'data'.
+// 'data' must stay valid for as long as the area exists (e.g. it points into the image of the page directory). The range can't overlap any existing area.
+void paging_add_vm_area(Page_Directory* page_directory, u32 first_page_num, u32 num_pages, u32 protection, const u8* data, u32 data_size) {
+	assert(data_size <= num_pages * 0x1000, "Virtual memory area data is bigger than the area (%u bytes)", data_size);
+	Vm_Area* previous = 0;
+	Vm_Area* next = page_directory->vm_areas;
+	while (next && next->first_page_num < first_page_num) {
+		previous = next;
+		next = next->next;
+	}
+	assert(!previous || previous->first_page_num + previous->num_pages <= first_page_num,
+		"Virtual memory area at 0x%x overlaps another area", first_page_num * 0x1000);
+	assert(!next || first_page_num + num_pages <= next->first_page_num,
+		"Virtual memory area at 0x%x overlaps another area", first_page_num * 0x1000);
+
+	Vm_Area* vm_area = insert_vm_area(page_directory, previous, first_page_num, num_pages, protection);
+	vm_area->data = data;
+	vm_area->data_size = data_size;
+}
+
+// Releases the frames of all present pages in [first_page_num, end_page_num). The caller must flush the TLB.
+static void release_process_pages(Page_Directory* page_directory, u32 first_page_num, u32 end_page_num) {
+	for (u32 page_num = first_page_num; page_num < end_page_num; ++page_num) {
+		Page_Entry* page_entry = find_present_page(page_directory, page_num);
+		if (page_entry) {
+			release_frame(page_entry->frame_address_20_bits);
+			memset(page_entry, 0, sizeof(Page_Entry));
+			paging_tlb_invalidate_page(page_directory, page_num);
+		}
+	}
+}
+
+// Validates a range given by the user, which must be page-aligned and inside the mmap area
+static s32 get_mmap_range(u32 addr, u32 length, u32* first_page_num, u32* num_pages) {
+	if (addr % 0x1000 != 0 || length == 0 || addr < PAGING_MMAP_AREA_START || addr >= PAGING_MMAP_AREA_END
+		|| length > PAGING_MMAP_AREA_END - addr) {
+		return -1;
+	}
+	*first_page_num = addr / 0x1000;
+	*num_pages = (length + 0xFFF) / 0x1000;
+	return 0;
+}
+
+// Maps 'length' bytes of anonymous memory (rounded up to whole pages), which will be zeroed on first touch.
+// If 'addr' is not 0, it is used as a hint. Otherwise (or if the hint is not available), the first free range is used.
+// Returns the address of the mapping, or 0 if there is no space for it.
+u32 paging_mmap(Page_Directory* page_directory, u32 addr, u32 length, u32 protection) {
+	u32 first_page_num, num_pages;
+	// The address is only a hint. If it is not usable (misaligned, outside of the mmap area or running past its end), the
+	// mapping is placed as if there was no hint.
+	if (addr && get_mmap_range(addr, length, &first_page_num, &num_pages)) {
+		addr = 0;
+	}
+	if (!addr && get_mmap_range(PAGING_MMAP_AREA_START, length, &first_page_num, &num_pages)) {
+		return 0;
+	}
+
+	// Find a hole that fits the mapping, starting at the hint (if any). 'previous' is the area right before the hole.
+	Vm_Area* previous = 0;
+	Vm_Area* next = page_directory->vm_areas;
+	while (next && next->first_page_num + next->num_pages <= first_page_num) {
+		previous = next;
+		next = next->next;
+	}
+	if (next && next->first_page_num < first_page_num + num_pages) {
+		// The hint is taken, so look for the first hole that fits from the start of the mmap area
+		previous = 0;
+		next = page_directory->vm_areas;
+		first_page_num = PAGING_MMAP_AREA_START / 0x1000;
+		while (next && next->first_page_num < first_page_num + num_pages) {
+			first_page_num = MAX(first_page_num, next->first_page_num + next->num_pages);
+			previous = next;
+			next = next->next;
+		}
+	}
+	if (first_page_num + num_pages > PAGING_MMAP_AREA_END / 0x1000) {
+		return 0;
+	}
+
+	insert_vm_area(page_directory, previous, first_page_num, num_pages, protection);
+	return first_page_num * 0x1000;
+}
+
+// Unmaps all pages in the given range. Parts of the range that are not mapped are ignored.
+// Returns 0 if success, -1 if the range is invalid.
+s32 paging_munmap(Page_Directory* page_directory, u32 addr, u32 length) {
+	u32 first_page_num, num_pages;
+	if (get_mmap_range(addr, length, &first_page_num, &num_pages)) {
+		return -1;
+	}
+	u32 end_page_num = first_page_num + num_pages;
+	split_vm_area(page_directory, first_page_num);
+	split_vm_area(page_directory, end_page_num);
+
+	Vm_Area** link = &page_directory->vm_areas;
+	while (*link) {
+		Vm_Area* vm_area = *link;
+		if (vm_area->first_page_num >= first_page_num && vm_area->first_page_num < end_page_num) {
+			release_process_pages(page_directory, vm_area->first_page_num, vm_area->first_page_num + vm_area->num_pages);
+			*link = vm_area->next;
+			kalloc_free(vm_area);
+		} else {
+			link = &vm_area->next;
+		}
+	}
+
+	paging_tlb_flush();
+	return 0;
+}
+
+// Changes the protection of all pages in the given range. The whole range must be mapped.
+// Returns 0 if success, -1 otherwise.
+s32 paging_mprotect(Page_Directory* page_directory, u32 addr, u32 length, u32 protection) {
+	u32 first_page_num, num_pages;
+	if (get_mmap_range(addr, length, &first_page_num, &num_pages)) {
+		return -1;
+	}
+	u32 end_page_num = first_page_num + num_pages;
+	for (u32 page_num = first_page_num; page_num < end_page_num;) {
+		Vm_Area* vm_area = find_vm_area(page_directory, page_num);
+		if (!vm_area) {
+			return -1;
+		}
+		page_num = vm_area->first_page_num + vm_area->num_pages;
+	}
+
+	split_vm_area(page_directory, first_page_num);
+	split_vm_area(page_directory, end_page_num);
+	for (Vm_Area* vm_area = find_vm_area(page_directory, first_page_num); vm_area && vm_area->first_page_num < end_page_num;
+		vm_area = vm_area->next) {
+		vm_area->protection = protection;
+		for (u32 page_num = vm_area->first_page_num; page_num < vm_area->first_page_num + vm_area->num_pages; ++page_num) {
+			Page_Entry* page_entry = find_present_page(page_directory, page_num);
+			if (page_entry) {
+				set_page_protection(page_entry, protection);
+				paging_tlb_invalidate_page(page_directory, page_num);
+			}
+		}
+	}
+
+	paging_tlb_flush();
+	return 0;
+}
+
+// Sets up an empty heap at 'heap_start' (page-aligned), which can grow up to 'heap_limit'.
+void paging_init_heap(Page_Directory* page_directory, u32 heap_start, u32 heap_limit) {
+	assert(heap_start % 0x1000 == 0, "Heap start must be 0x1000 aligned (got 0x%x)", heap_start);
+	assert(heap_start <= heap_limit, "Heap start (0x%x) is above its limit (0x%x)", heap_start, heap_limit);
+	page_directory->heap_start = heap_start;
+	page_directory->heap_break = heap_start;
+	page_directory->heap_limit = heap_limit;
+}
+
+// Moves the end of the heap to 'new_break'. New heap pages are zeroed on first touch, and the pages that are no longer
+// part of the heap are released. Returns the new break, or the current break if it can't be moved (in which case
+// nothing changes). Passing 0 just returns the current break.
+u32 paging_brk(Page_Directory* page_directory, u32 new_break) {
+	if (new_break < page_directory->heap_start || new_break > page_directory->heap_limit) {
+		return page_directory->heap_break;
+	}
+
+	u32 first_page_num = page_directory->heap_start / 0x1000;
+	u32 old_end_page_num = (page_directory->heap_break + 0xFFF) / 0x1000;
+	u32 new_end_page_num = (new_break + 0xFFF) / 0x1000;
+	// 'previous' is the heap area (if the heap is not empty) or the area right before the heap
+	Vm_Area* previous = 0;
+	Vm_Area* next = page_directory->vm_areas;
+	while (next && next->first_page_num < old_end_page_num) {
+		previous = next;
+		next = next->next;
+	}
+	Vm_Area* heap_vm_area = old_end_page_num > first_page_num ? previous : 0;
+
+	if (new_end_page_num > old_end_page_num) {
+		if (next && next->first_page_num < new_end_page_num) {
+			return page_directory->heap_break;
+		}
+		if (heap_vm_area) {
+			heap_vm_area->num_pages = new_end_page_num - first_page_num;
+		} else {
+			insert_vm_area(page_directory, previous, first_page_num, new_end_page_num - first_page_num,
+				PAGING_PROTECTION_READ | PAGING_PROTECTION_WRITE);
+		}
+	} else if (new_end_page_num < old_end_page_num) {
+		release_process_pages(page_directory, new_end_page_num, old_end_page_num);
+		paging_tlb_flush();
+		if (new_end_page_num > first_page_num) {
+			heap_vm_area->num_pages = new_end_page_num - first_page_num;
+		} else {
+			// The heap is empty again, so its area goes away
+			Vm_Area** link = &page_directory->vm_areas;
+			while (*link != heap_vm_area) {
+				link = &(*link)->next;
+			}
+			*link = heap_vm_area->next;
+			kalloc_free(heap_vm_area);
+		}
+	}
+
+	page_directory->heap_break = new_break;
+	return new_break;
+}
+
+// Handles an access to a page that is not present, but is part of a virtual memory area.
+// A new frame is mapped with the protection of the area, and filled with the area data (or zeroes).
+// Returns 1 if the fault was handled, 0 otherwise.
+static s32 handle_vm_area_fault(Page_Directory* page_directory, u32 faulting_addr) {
+	u32 page_num = faulting_addr / 0x1000;
+	Vm_Area* vm_area = find_vm_area(page_directory, page_num);
+	if (!vm_area || vm_area->protection == PAGING_PROTECTION_NONE) {
+		return 0;
+	}
+
+	u32 data_offset = (page_num - vm_area->first_page_num) * 0x1000;
+	u32 data_chunk_size = vm_area->data_size > data_offset ? MIN(0x1000, vm_area->data_size - data_offset) : 0;
+	paging_create_process_page_with_zeroed_frame(page_directory, page_num, 1);
+	if (data_chunk_size > 0) {
+		// The page belongs to the active address space and is still writable, so it can be filled directly
+		memcpy((void*)(page_num * 0x1000), vm_area->data + data_offset, data_chunk_size);
+	}
+	Page_Entry* page_entry = find_present_page(page_directory, page_num);
+	set_page_protection(page_entry, vm_area->protection);
+	paging_tlb_invalidate_page(page_directory, page_num);
+	paging_tlb_flush();
+	return 1;
+}
+
+/* ******************** */
+
 // Gets a page from a page directory. The page must already exist.
 static Page_Entry* get_page(const Page_Directory* page_directory, u32 page_num) {
 	u32 page_table_index = page_num / 1024;
 	u32 page_num_within_table = page_num % 1024;
 
+	assert(!is_large_page(page_directory, page_table_index), "Trying to get page %u (0x%x), which is part of a 4MB page!",
+		page_num, page_num * 0x1000);
 	assert(page_directory->tables[page_table_index] != 0, "Trying to get page %u (0x%x) from a table that is not created (%u)!",
 		page_num, page_num * 0x1000, page_table_index);
 	Page_Entry* page_entry = &page_directory->tables[page_table_index]->pages[page_num_within_table];
@@ -362,9 +1314,64 @@ static Page_Entry* get_page(const Page_Directory* page_directory, u32 page_num)
 	return page_entry;
 }
 
+// Handles a write to a copy-on-write page.
+// If the frame is still shared, the page receives a copy of it. Otherwise, the page simply becomes writable again.
+// Returns 1 if the fault was handled, 0 otherwise.
+static s32 handle_copy_on_write_fault(Page_Directory* page_directory, u32 faulting_addr) {
+	u32 page_num = faulting_addr / 0x1000;
+	u32 page_table_index = page_num / 1024;
+	u32 page_num_within_table = page_num % 1024;
+
+	if (!page_directory->tables[page_table_index]) {
+		return 0;
+	}
+
+	Page_Entry* page_entry = &page_directory->tables[page_table_index]->pages[page_num_within_table];
+	if (!page_entry->present || !page_entry->copy_on_write) {
+		return 0;
+	}
+
+	// The page might be part of a virtual memory area that became read-only after it was shared
+	Vm_Area* vm_area = find_vm_area(page_directory, page_num);
+	if (vm_area && !(vm_area->protection & PAGING_PROTECTION_WRITE)) {
+		return 0;
+	}
+
+	u32 frame = page_entry->frame_address_20_bits;
+	if (paging.frame_reference_counts[frame] > 1) {
+		u32 allocd_frame = allocate_frame();
+		paging_copy_frame(allocd_frame * 0x1000, frame * 0x1000);
+		release_frame(frame);
+		page_entry->frame_address_20_bits = allocd_frame;
+	}
+
+	page_entry->copy_on_write = 0;
+	page_entry->writable = 1;
+	paging_tlb_invalidate_page(page_directory, page_num);
+	paging_tlb_flush();
+	return 1;
+}
+
 static void page_fault_handler(Interrupt_Handler_Args* args) {
 	u32 faulting_addr = paging_get_faulting_address();
 
+	// A write to a present page might be a write to a copy-on-write page.
+	// Note that the kernel also faults here when writing to user buffers, since CR0.WP is set.
+	if ((args->err_code & 0x1) && (args->err_code & 0x2)) {
+		Page_Directory* page_directory = process_get_active_page_directory();
+		if (page_directory && handle_copy_on_write_fault(page_directory, faulting_addr)) {
+			return;
+		}
+	}
+
+	// An access to a page that is not present might be the first access to a page of a virtual memory area.
+	if (!(args->err_code & 0x1)) {
+		Page_Directory* page_directory = process_get_active_page_directory();
+		if (page_directory && handle_vm_area_fault(page_directory, faulting_addr)) {
+			return;
+		}
+	}
+
 	// The error code gives us details of what happened.
 	u32 present = !(args->err_code & 0x1);   // Page not present
 	u32 rw = args->err_code & 0x2;           // Write operation?
@@ -379,6 +1386,11 @@ static void page_fault_handler(Interrupt_Handler_Args* args) {
 	if (us) printf("user-mode ");
 	if (reserved) printf("reserved ");
 	printf(") at 0x%x\n", faulting_addr);
+
+	// A fault in user-mode is a bug of the process, not of the kernel. For now, just kill it.
+	if (us) {
+		process_exit(255);
+	}
 	panic("Page fault");
 }
 
@@ -386,7 +1398,9 @@ static void print_all_present_pages(const Page_Directory* page_directory) {
 	printf("Present pages:\n");
 	for (u32 i = 0; i < 1024; ++i) {
 		Page_Table* current_page_table = page_directory->tables[i];
-		if (current_page_table) {
+		if (is_large_page(page_directory, i)) {
+			printf("%x (4MB) ", (void*)(0x400000 * i));
+		} else if (current_page_table) {
 			for (u32 j = 0; j < 1024; ++j) {
 				Page_Entry* page_entry = &current_page_table->pages[j];
 				if (page_entry->present) {
@@ -398,72 +1412,69 @@ static void print_all_present_pages(const Page_Directory* page_directory) {
 	printf("\n");
 }
 
-void paging_init() {
-	bitmap_init(&paging.available_frames, available_frames_bitmap_data, AVAILABLE_FRAMES_NUM / 8);
+void paging_init(const E820_Memory_Map* memory_map) {
+	// The bitmap of available frames is reserved right after the kernel, so it will be part of the kernel identity map.
+	init_available_frames(memory_map);
 
 	// We allocate a page_directory for the kernel.
 	paging.kernel_page_directory = reserve_pre_paging_aligned_space(sizeof(Page_Directory));
-
-	// First, we pre-allocate some necessary page-tables.
-	// We are basically allocating all the page-tables that may contain pages used by other page-tables.
-	// e.g. if our KERNEL_PAGE_TABLE_ADDRESS is 0x100000, then we know for sure that the page table virtual space will
-	// be reserved from 0x100000 to 0x500000.
-	// In this case, we know that all page tables from 0x100000 to 0x400000 will be stored as pages located in the
-	// page table 0, whereas all pages tables from 0x400000 to 0x500000 will be stored as pages located in the page table 1.
-	// So, we pre-allocate page-table 0 and 1.
-	// This is necessary to avoid an "chicken-and-egg" problem after paging is enabled. For example, let's say that we enable paging,
-	// but we didn't pre-allocate page-table 1. Then, we need to create a page that falls in page-table 1. In this case, we then try
-	// to allocate a page to store page table 1, but then we find out that the page table 1 page also falls in page table 1! In this
-	// case we are screwed, since we can never write to that page, because we don't have a virtual address to use.
-	assert(KERNEL_PAGE_TABLES_ADDRESS % 0x1000 == 0, "The virtual address of kernel page tables must be multiple of 0x1000!");
-
-	u32 first_page_table_index = (KERNEL_PAGE_TABLES_ADDRESS / 0x1000) / 1024;
-	u32 last_page_table_index = ((KERNEL_PAGE_TABLES_ADDRESS + 0x400000) / 0x1000) / 1024;
-	printf("Pre-creating page tables from %u to %u.\n", first_page_table_index, last_page_table_index);
-	for (u32 i = first_page_table_index; i <= last_page_table_index; ++i) {
-		create_pre_paging_page_table(i);
-	}
-
-	// First, we reserve N pages for the kernel stack (N is KERNEL_STACK_RESERVED_PAGES)
-	// We start at KERNEL_STACK_ADDRESS and go down.
-	for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES; ++i) {
-		u32 page_num = (KERNEL_STACK_ADDRESS / 0x1000) - i;
-		create_pre_paging_mapping(page_num, page_num);
+	// The kernel page directory is identity mapped
+	paging.kernel_page_directory->tables_x86_representation_frame_address = (u32)paging.kernel_page_directory->tables_x86_representation;
+
+	// First, we identity map the first 4MB with a single global 4MB page. It has everything that is already in RAM and
+	// must keep its address: the kernel code and data (plus what was reserved after it), the boot stack, the video memory
+	// and the kernel page tables. These frames are never released.
+	assert(final_kernel_code_data_addr <= 0x400000 && KERNEL_PAGE_TABLES_ADDRESS % 0x1000 == 0 &&
+		KERNEL_PAGE_TABLES_ADDRESS + (KERNEL_ADDRESS_SPACE_END / 0x400000) * 0x1000 <= 0x400000,
+		"The kernel and its page tables must fit in the first 4MB!");
+	// Frames above the usable RAM (e.g. video memory) are not tracked by the bitmap
+	for (u32 i = 0; i < 1024 && i < paging.num_frames; ++i) {
+		bitmap_set(&paging.available_frames, i);
 	}
-
-	// Here we perform an identity map on the video memory.
-	// In the future, we might wanna reserve another space in the kernel address space for the video memory.
-	for (u32 i = 0xA0000; i < 0xC0000; i += 0x1000) {
-		u32 page_num = i / 0x1000;
-		create_pre_paging_mapping(page_num, page_num);
+	create_pre_paging_large_mapping(0, 0);
+
+	// Then, we create all the other page tables of the kernel address space (the first 1GB), which costs 1MB.
+	// Since the kernel page directory entries never change after this, every address space can simply copy them (see
+	// 'paging_clone_page_directory_for_new_process'), and kernel pages created later are immediately visible everywhere.
+	u32 last_page_table_index = KERNEL_ADDRESS_SPACE_END / 0x400000 - 1;
+	printf("Pre-creating page tables from 1 to %u.\n", last_page_table_index);
+	for (u32 i = 1; i <= last_page_table_index; ++i) {
+		create_pre_paging_page_table(i);
 	}
 
-	// Here, we create pages for all the kernel code and data that is currently in RAM.
-	// We use an identity map (VIRTUAL ADDRESS = PHYSICAL ADDRESS), meaning that the pages will point to frames with same address.
-	// Also note that 'allocate_frame_to_get_page' might need to allocate memory for the page tables.
-	// Because of this, 'kmalloc_addr' might change in the middle of the loop. We need to be sure that we are
-	// accounting for that, since all kmalloc/kcalloc'd stuff need to be part of the identity map.
-	// @NOTE: If the kernel grows enough, this might invade the address space reserved for the video memory (see above)
-	// If this happens, we will need to change the virtual space reserved for the video memory, instead of performing an identity map.
-	for (u32 i = 0; i < final_kernel_code_data_addr; i += 0x1000) {
-		u32 page_num = i / 0x1000;
-		create_pre_paging_mapping(page_num, page_num);
+	// Now that every frame that must be identity mapped is marked as used, we reserve N pages for the kernel stack
+	// (N is KERNEL_STACK_RESERVED_PAGES). The stack is big and static, so we map it with 4MB pages, going down from
+	// KERNEL_STACK_ADDRESS. The frames are taken from usable RAM.
+	assert(KERNEL_STACK_ADDRESS % 0x400000 == 0 && KERNEL_STACK_RESERVED_PAGES % 1024 == 0,
+		"The kernel stack must be made of whole 4MB pages!");
+	for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES / 1024; ++i) {
+		u32 page_table_index = (KERNEL_STACK_ADDRESS / 0x400000) - 1 - i;
+		u32 frame_addr = paging_alloc_frames(PAGING_MAX_FRAMES_ORDER);
+		assert(frame_addr != 0, "There is no contiguous 4MB of RAM left for the kernel stack!");
+		create_pre_paging_large_mapping(page_table_index, frame_addr / 0x1000);
 	}
-
-	// @TEMPORARY: For now, let's pretend all frames below 0x100000 are used.
-	// This is to avoid using this frames later.
-	// Some of these frames are not addressable! So we avoid this issues.
-	// @TODO: Find a good documentation about x86 protected mode memory map and understand in detail
-	// which frames are reserved for MMIO, so we can treat them specially.
-	for (u32 i = 0; i < 0x100000; i += 0x1000) {
-		bitmap_set(&paging.available_frames, i / 0x1000);
+	// The kernel stack is part of the address space that is copied to the first process (see 'paging_clone_page_directory_for_new_process')
+	for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES; ++i) {
+		add_page_to_regions(paging.kernel_page_directory, KERNEL_STACK_ADDRESS / 0x1000 - KERNEL_STACK_RESERVED_PAGES + i);
 	}
 
 	// Finally, we enable paging using the kernel page directory that we just created.
-	paging_switch_page_directory((u32)paging.kernel_page_directory->tables_x86_representation);
+	// 4MB pages need to be enabled first, since the first 4MB and the kernel stack are already using them.
+	paging_enable_large_pages();
+	paging_switch_page_directory(paging.kernel_page_directory->tables_x86_representation_frame_address);
+	// Kernel pages are global, so they are not flushed from the TLB on every context switch.
+	paging_set_global_pages(1);
 
 	interrupt_register_handler(page_fault_handler, 14);
 
+	// Now that paging is enabled, we map the frame reference counts, needed for copy-on-write.
+	u32 frame_reference_counts_size = paging.num_frames * sizeof(u16);
+	for (u32 i = 0; i < frame_reference_counts_size; i += 0x1000) {
+		paging_create_kernel_page_with_any_frame((FRAME_REFERENCE_COUNTS_ADDRESS + i) / 0x1000);
+	}
+	memset((void*)FRAME_REFERENCE_COUNTS_ADDRESS, 0, frame_reference_counts_size);
+	paging.frame_reference_counts = (u16*)FRAME_REFERENCE_COUNTS_ADDRESS;
+
 	//print_all_present_pages();
 
 	//create_page_with_any_frame(0x4ABDF);
@@ -5,13 +5,65 @@
 #define KERNEL_STACK_RESERVED_PAGES 2048
 // We can only use 3GB of PHYSICAL_RAM_SIZE because of the 3GB barrier imposed by the hardware
 // https://en.wikipedia.org/wiki/3_GB_barrier
+// This is only an upper bound. The RAM that is actually usable is given by the BIOS memory map (see E820_Memory_Map).
 #define PHYSICAL_RAM_SIZE 0xC0000000
-// The address in which the kernel stack is stored.
-// @NOTE: If this value is changed, we need to change in kernel_entry.asm aswell.
-// @TODO: Make both places consume the same constant
+// The address in which the kernel stack is stored. Its frames are taken from usable RAM by 'paging_init', so the kernel
+// only switches to it once paging is enabled (see 'main').
 #define KERNEL_STACK_ADDRESS 0xC0000000
-#define AVAILABLE_FRAMES_NUM (PHYSICAL_RAM_SIZE / 0x1000)
+// Until paging is enabled, the kernel runs on a small stack in conventional memory, identity mapped by 'paging_init'.
+// The kernel image (and everything reserved after it before paging is enabled) must stay below BOOT_STACK_LIMIT.
+// @NOTE: If these values are changed, we need to change in kernel_entry.asm, boot_sect.asm and link.ld aswell.
+#define BOOT_STACK_ADDRESS 0x90000
+#define BOOT_STACK_LIMIT 0x80000
+#define MAX_FRAMES_NUM (PHYSICAL_RAM_SIZE / 0x1000)
+// Address in which the bootloader stores the BIOS memory map
+// @NOTE: If these values are changed, we need to change in boot_sect.asm aswell.
+#define E820_MEMORY_MAP_ADDRESS 0x500
+#define E820_MEMORY_MAP_MAX_ENTRIES 64
+#define E820_TYPE_USABLE 1
 #define KERNEL_PAGE_TABLES_ADDRESS 0x00100000
+// The first 1GB of every address space belongs to the kernel and is the same in all page directories.
+// Pages in this range are global, so their TLB entries survive page directory switches.
+#define KERNEL_ADDRESS_SPACE_END 0x40000000
+// Flags of the x86 page directory entry. A page directory entry with PAGE_DIRECTORY_ENTRY_LARGE set maps a 4MB page directly,
+// instead of pointing to a page table. In this case, 'tables' is 0 and only 'tables_x86_representation' is used.
+#define PAGE_DIRECTORY_ENTRY_PRESENT 0x1
+#define PAGE_DIRECTORY_ENTRY_WRITABLE 0x2
+#define PAGE_DIRECTORY_ENTRY_USER_MODE 0x4
+#define PAGE_DIRECTORY_ENTRY_LARGE 0x80
+#define PAGE_DIRECTORY_ENTRY_GLOBAL 0x100
+#define PAGE_DIRECTORY_ENTRY_LARGE_FRAME_MASK 0xFFC00000
+// The address in which the reference count of each frame is stored (one u16 per frame)
+#define FRAME_REFERENCE_COUNTS_ADDRESS 0x30000000
+// Kernel pages reserved for page tables and page directories, which are allocated one page at a time (instead of using the heap)
+#define PAGE_TABLE_MEMORY_ADDRESS 0x38000000
+#define PAGE_TABLE_MEMORY_END TEMPORARY_MAPPING_ADDRESS
+// Kernel pages reserved to temporarily map frames, so they can be accessed without disabling paging.
+#define TEMPORARY_MAPPING_ADDRESS 0x3FC00000
+#define TEMPORARY_MAPPING_SLOTS 2
+// The biggest block of contiguous frames handed out by 'paging_alloc_frames' is 2^PAGING_MAX_FRAMES_ORDER frames (4MB).
+// Blocks are found by scanning the bitmap of available frames (O(number of frames)) instead of keeping buddy free lists:
+// blocks are only allocated for kernel stacks, and free lists would hold frames back from 'allocate_frame'. Fragmentation
+// is observable through 'paging_get_frames_statistics' (/dev/frames) instead of per-order free list counters.
+#define PAGING_MAX_FRAMES_ORDER 10
+// If more pages than this are waiting to be invalidated, the whole TLB is flushed instead of invalidating page by page
+#define PAGING_TLB_INVALIDATION_THRESHOLD 32
+// Maximum number of ranges of adjacent pages that can wait to be invalidated. If there are more, the whole TLB is flushed.
+#define PAGING_TLB_MAX_PENDING_RANGES 8
+// Maximum number of regions tracked by each page directory. If more are needed, the closest regions are extended instead.
+#define PAGING_MAX_REGIONS 16
+// Maximum number of pre-zeroed frames kept in the zero pool
+#define PAGING_ZERO_POOL_CAPACITY 256
+// Maximum number of frames zeroed each time the zero pool is refilled
+#define PAGING_ZERO_POOL_REFILL_FRAMES 4
+// Part of the process address space reserved for memory mapped with mmap
+#define PAGING_MMAP_AREA_START 0xD0000000
+#define PAGING_MMAP_AREA_END 0xE0000000
+// Protection flags of virtual memory areas. Pages can always be read, unless the area has no flags at all.
+#define PAGING_PROTECTION_NONE 0x0
+#define PAGING_PROTECTION_READ 0x1
+#define PAGING_PROTECTION_WRITE 0x2
+#define PAGING_PROTECTION_EXECUTE 0x4
 
 // The page entry, as defined by Intel in the x86 architecture
 typedef struct {
@@ -21,16 +73,57 @@ typedef struct {
 	u32 reserved : 2;           // Reserved for the CPU. Cannot be changed.
 	u32 accessed : 1;           // Gets set if the page is accessed (by the CPU)
 	u32 dirty : 1;              // Gets set if the page has been written to (by the CPU)
-	u32 reserved2 : 2;          // Reserved for the CPU. Cannot be changed.
-	u32 available : 3;          // Unused and available for kernel use.
+	u32 pat : 1;                // Page attribute table index. Not used.
+	u32 global : 1;             // If set (and CR4.PGE is set), the TLB entry is not flushed when CR3 is reloaded. Only for pages that are the same in all address spaces.
+	u32 copy_on_write : 1;      // Set by the kernel when the frame is shared and the page must be copied on the first write.
+	u32 available : 2;          // Unused and available for kernel use.
 	u32 frame_address_20_bits : 20;     // The high 20 bits of the frame address in RAM.
 } Page_Entry;
 
+// An entry of the BIOS memory map (INT 0x15, EAX=0xE820)
+typedef struct {
+	u64 base;
+	u64 length;
+	u32 type;                   // E820_TYPE_USABLE for RAM that can be freely used. Everything else must be left alone.
+	u32 extended_attributes;
+} __attribute__((packed)) E820_Entry;
+
+// The BIOS memory map, as stored by the bootloader
+typedef struct {
+	u32 num_entries;
+	E820_Entry entries[E820_MEMORY_MAP_MAX_ENTRIES];
+} __attribute__((packed)) E820_Memory_Map;
+
 // The page table. Each page table contains 1024 pages.
 typedef struct {
 	Page_Entry pages[1024];
 } Page_Table;
 
+// A range of consecutive pages
+typedef struct {
+	u32 first_page_num;
+	u32 num_pages;
+} Page_Region;
+
+// A virtual memory area: a range of the process address space that is populated on demand.
+// Pages are only created when they are touched for the first time (see 'page_fault_handler').
+// The first 'data_size' bytes of the area are copied from 'data', the rest is zeroed.
+typedef struct Vm_Area {
+	u32 first_page_num;
+	u32 num_pages;
+	u32 protection;             // PAGING_PROTECTION_* flags
+	const u8* data;
+	u32 data_size;
+	struct Vm_Area* next;
+} Vm_Area;
+
+// The memory that the data of virtual memory areas points into (e.g. a RawX image). Page directories cloned from each
+// other share it, and it is freed when the last one of them is cleaned.
+typedef struct {
+	u32 references;
+	u8 data[0];
+} Vm_Image;
+
 // The page directory. Each page directory contains 1024 page tables.
 typedef struct {
 	// Pointers to each page table
@@ -41,15 +134,75 @@ typedef struct {
 	// The only difference here is that the last three nibbles are reserved for flags
 	// (they are not needed since all ptrs must be aligned to 0x1000).
 	u32 tables_x86_representation[1024];
+	// The physical address of 'tables_x86_representation' (the value loaded in the CR3 register)
+	u32 tables_x86_representation_frame_address;
+	// The populated ranges of the process address space (1GB-4GB), sorted by address.
+	// Every present page of this range belongs to a region (but regions might contain pages that are not present).
+	// This allows cleaning and cloning the page directory without going through the whole address space.
+	Page_Region regions[PAGING_MAX_REGIONS];
+	u32 num_regions;
+	// The virtual memory areas of the process, sorted by address and never overlapping
+	Vm_Area* vm_areas;
+	// The image that the data of the virtual memory areas points into, if any
+	Vm_Image* vm_image;
+	// The heap of the process, which is moved with brk. The heap is a virtual memory area that starts empty at 'heap_start'
+	// and ends at 'heap_break' (rounded up to a whole page). It can't grow past 'heap_limit' or into another area.
+	u32 heap_start;
+	u32 heap_break;
+	u32 heap_limit;
 } Page_Directory;
 
-void paging_init();
+typedef struct {
+	u32 full_flushes;           // Number of times the whole TLB was flushed
+	u32 page_invalidations;     // Number of pages invalidated one by one (invlpg)
+	u32 uptime_seconds;         // Time since boot when the statistics were taken, to derive flush rates
+} Paging_Tlb_Statistics;
+
+typedef struct {
+	// For each order, the number of free blocks of 2^order frames aligned to 2^order frames (i.e. the blocks that
+	// 'paging_alloc_frames' could still hand out). Comparing the orders shows how fragmented the free frames are.
+	u32 free_blocks[PAGING_MAX_FRAMES_ORDER + 1];
+} Paging_Frames_Statistics;
+
+typedef struct {
+	u32 frames;                 // Number of pre-zeroed frames currently in the pool
+	u32 hits;                   // Number of zeroed frames taken from the pool
+	u32 misses;                 // Number of zeroed frames requested while the pool was empty (zeroed on the spot)
+	u32 refills;                // Number of frames zeroed in the background
+} Paging_Zero_Pool_Statistics;
+
+void paging_init(const E820_Memory_Map* memory_map);
+u32 paging_alloc_frames(u32 order);
+void paging_free_frames(u32 frame_addr, u32 order);
+void paging_get_frames_statistics(Paging_Frames_Statistics* statistics);
 u32 paging_create_process_page_with_any_frame(Page_Directory* page_directory, u32 page_num, u32 user_mode);
+u32 paging_create_process_page_with_zeroed_frame(Page_Directory* page_directory, u32 page_num, u32 user_mode);
 u32 paging_create_kernel_page_with_any_frame(u32 page_num);
-Page_Directory* paging_clone_page_directory_for_new_process(const Page_Directory* page_directory);
+void paging_remove_kernel_page(u32 page_num);
+Page_Directory* paging_clone_page_directory_for_new_process(Page_Directory* page_directory);
 u32 paging_get_page_directory_x86_tables_frame_address(const Page_Directory* page_directory);
 u32 paging_get_page_frame_address(const Page_Directory* page_directory, u32 page_num);
 Page_Directory* paging_get_kernel_page_directory();
 void paging_clean_all_non_kernel_pages_from_page_directory(Page_Directory* page_directory);
+void paging_free_page_directory(Page_Directory* page_directory);
+u8* paging_alloc_vm_image(Page_Directory* page_directory, u32 size);
+void paging_add_vm_area(Page_Directory* page_directory, u32 first_page_num, u32 num_pages, u32 protection, const u8* data, u32 data_size);
+u32 paging_mmap(Page_Directory* page_directory, u32 addr, u32 length, u32 protection);
+s32 paging_munmap(Page_Directory* page_directory, u32 addr, u32 length);
+s32 paging_mprotect(Page_Directory* page_directory, u32 addr, u32 length, u32 protection);
+void paging_init_heap(Page_Directory* page_directory, u32 heap_start, u32 heap_limit);
+u32 paging_brk(Page_Directory* page_directory, u32 new_break);
+void paging_copy_frame(u32 frame_dst_addr, u32 frame_src_addr);
+s32 paging_compare_frame(u32 frame1_addr, u32 frame2_addr);
+void paging_zero_frame(u32 frame_addr);
+void paging_tlb_invalidate_page(const Page_Directory* page_directory, u32 page_num);
+void paging_tlb_flush();
+void paging_tlb_flush_all();
+void paging_get_tlb_statistics(Paging_Tlb_Statistics* statistics);
+void paging_zero_pool_refill(u32 max_frames);
+void paging_get_zero_pool_statistics(Paging_Zero_Pool_Statistics* statistics);
+void paging_print_zero_pool_statistics();
+void paging_get_temporary_mappings(u32 frame_addrs[TEMPORARY_MAPPING_SLOTS]);
+void paging_restore_temporary_mappings(const u32 frame_addrs[TEMPORARY_MAPPING_SLOTS]);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "paging_benchmark.h"
+#ifdef BOOT_BENCHMARKS_ENABLED
+#include "paging.h"
+#include "asm/paging.h"
+#include "asm/util.h"
+#include "asm/process.h"
+#include "util/util.h"
+#include "util/printf.h"
+#include "util/bitmap.h"
+
+#define BENCHMARK_ADDRESS 0x20000000
+#define COPY_FRAME_ITERATIONS 512
+#define FRAME_ALLOCATOR_BENCHMARK_ADDRESS (BENCHMARK_ADDRESS + 0x10000)
+#define FRAME_ALLOCATOR_ITERATIONS 64
+#define GLOBAL_PAGES_BENCHMARK_ADDRESS (BENCHMARK_ADDRESS + 0x100000)
+#define GLOBAL_PAGES_BENCHMARK_PAGES 64
+#define GLOBAL_PAGES_ITERATIONS 256
+
+// Benchmark pages live in the range the kernel heap grows into, so they must be removed once the benchmark is done
+static void remove_benchmark_pages(u32 first_page_num, u32 num_pages) {
+	for (u32 i = 0; i < num_pages; ++i) {
+		paging_remove_kernel_page(first_page_num + i);
+	}
+	paging_tlb_flush();
+}
+
+// Compares the old frame copy (which disables paging) against the new one (which uses the temporary mappings).
+static void benchmark_copy_frame() {
+	u32 src_page_num = BENCHMARK_ADDRESS / 0x1000;
+	u32 dst_page_num = src_page_num + 1;
+	u32 src_frame_addr = paging_create_kernel_page_with_any_frame(src_page_num) * 0x1000;
+	u32 dst_frame_addr = paging_create_kernel_page_with_any_frame(dst_page_num) * 0x1000;
+
+	u32* src = (u32*)(src_page_num * 0x1000);
+	for (u32 i = 0; i < 1024; ++i) {
+		src[i] = i * 2654435761u;
+	}
+
+	u64 start = util_rdtsc();
+	for (u32 i = 0; i < COPY_FRAME_ITERATIONS; ++i) {
+		paging_copy_frame_with_paging_disabled(dst_frame_addr, src_frame_addr);
+	}
+	u32 old_cycles = (u32)(util_rdtsc() - start);
+	assert(paging_compare_frame(dst_frame_addr, src_frame_addr) == 0, "benchmark: old frame copy is broken");
+
+	paging_zero_frame(dst_frame_addr);
+	assert(paging_compare_frame(dst_frame_addr, src_frame_addr) != 0, "benchmark: frame zeroing is broken");
+
+	start = util_rdtsc();
+	for (u32 i = 0; i < COPY_FRAME_ITERATIONS; ++i) {
+		paging_copy_frame(dst_frame_addr, src_frame_addr);
+	}
+	u32 new_cycles = (u32)(util_rdtsc() - start);
+	assert(paging_compare_frame(dst_frame_addr, src_frame_addr) == 0, "benchmark: new frame copy is broken");
+
+	printf("benchmark: copy frame with paging disabled: %u cycles/frame\n", old_cycles / COPY_FRAME_ITERATIONS);
+	printf("benchmark: copy frame with temporary mappings: %u cycles/frame\n", new_cycles / COPY_FRAME_ITERATIONS);
+	remove_benchmark_pages(src_page_num, 2);
+}
+
+// The frame allocation algorithm used before the bitmap was scanned one word at a time: one bit at a time, from frame 0.
+static u32 legacy_bitmap_get_first_clear(const Bitmap* bitmap) {
+	for (u32 i = 0; i < bitmap->size; ++i) {
+		for (u32 j = 0; j < 8; ++j) {
+			if (!(bitmap->data[i] & (1 << j))) {
+				return i * 8 + j;
+			}
+		}
+	}
+	return 0;
+}
+
+static u32 measure_frame_allocations(Bitmap* bitmap, s32 legacy) {
+	u32 allocd_frames[FRAME_ALLOCATOR_ITERATIONS];
+	u64 start = util_rdtsc();
+	for (u32 i = 0; i < FRAME_ALLOCATOR_ITERATIONS; ++i) {
+		allocd_frames[i] = legacy ? legacy_bitmap_get_first_clear(bitmap) : bitmap_get_first_clear(bitmap);
+		bitmap_set(bitmap, allocd_frames[i]);
+	}
+	u32 cycles = (u32)(util_rdtsc() - start);
+	for (u32 i = 0; i < FRAME_ALLOCATOR_ITERATIONS; ++i) {
+		bitmap_clear(bitmap, allocd_frames[FRAME_ALLOCATOR_ITERATIONS - 1 - i]);
+	}
+	return cycles / FRAME_ALLOCATOR_ITERATIONS;
+}
+
+// Measures the frame allocation latency as the memory fills up, comparing the old bit-by-bit scan against the current one.
+// A private bitmap with the same size as the one used by paging is used, so the real one is not disturbed.
+static void benchmark_frame_allocator() {
+	const u32 bitmap_size = MAX_FRAMES_NUM / 8;
+	const u32 summary_size = MAX_FRAMES_NUM / 32 / 8;
+	const u32 fill_percentages[] = {0, 25, 50, 75, 90, 99};
+	const u32 num_pages = (bitmap_size + summary_size + 0xFFF) / 0x1000;
+
+	for (u32 i = 0; i < num_pages; ++i) {
+		paging_create_kernel_page_with_any_frame(FRAME_ALLOCATOR_BENCHMARK_ADDRESS / 0x1000 + i);
+	}
+	u8* data = (u8*)FRAME_ALLOCATOR_BENCHMARK_ADDRESS;
+	u32* summary = (u32*)(FRAME_ALLOCATOR_BENCHMARK_ADDRESS + bitmap_size);
+
+	for (u32 i = 0; i < sizeof(fill_percentages) / sizeof(u32); ++i) {
+		Bitmap bitmap;
+		memset(data, 0, bitmap_size);
+		bitmap_init(&bitmap, data, bitmap_size, summary);
+
+		u32 used_frames = MAX_FRAMES_NUM / 100 * fill_percentages[i];
+		for (u32 j = 0; j < used_frames; ++j) {
+			bitmap_set(&bitmap, j);
+		}
+
+		u32 legacy_cycles = measure_frame_allocations(&bitmap, 1);
+		u32 cycles = measure_frame_allocations(&bitmap, 0);
+		printf("benchmark: frame allocation with memory %u%% full: %u cycles (old: %u cycles)\n",
+			fill_percentages[i], cycles, legacy_cycles);
+	}
+	remove_benchmark_pages(FRAME_ALLOCATOR_BENCHMARK_ADDRESS / 0x1000, num_pages);
+}
+
+// Allocates blocks of contiguous frames of every order and frees them, checking that freed blocks can be allocated again
+static void benchmark_contiguous_frames() {
+	u32 blocks[PAGING_MAX_FRAMES_ORDER + 1];
+
+	u64 start = util_rdtsc();
+	for (u32 order = 0; order <= PAGING_MAX_FRAMES_ORDER; ++order) {
+		blocks[order] = paging_alloc_frames(order);
+		assert(blocks[order] != 0, "benchmark: allocation of contiguous frames of order %u failed", order);
+		assert(blocks[order] % ((1 << order) * 0x1000) == 0, "benchmark: block 0x%x is not aligned", blocks[order]);
+	}
+	for (u32 order = 0; order <= PAGING_MAX_FRAMES_ORDER; ++order) {
+		paging_free_frames(blocks[order], order);
+	}
+	u32 cycles = (u32)(util_rdtsc() - start);
+
+	// The first fit of the biggest order can only move down after its frames were freed
+	u32 block = paging_alloc_frames(PAGING_MAX_FRAMES_ORDER);
+	assert(block != 0 && block <= blocks[PAGING_MAX_FRAMES_ORDER], "benchmark: freed frames were not reused");
+	paging_free_frames(block, PAGING_MAX_FRAMES_ORDER);
+	printf("benchmark: contiguous frames, %u allocations and frees: %u cycles\n", 2 * (PAGING_MAX_FRAMES_ORDER + 1), cycles);
+}
+
+// Simulates what happens after a context switch: the page directory is reloaded and the kernel touches a few of its pages.
+static u32 measure_context_switches() {
+	volatile u32* pages = (volatile u32*)GLOBAL_PAGES_BENCHMARK_ADDRESS;
+	u64 start = util_rdtsc();
+	for (u32 i = 0; i < GLOBAL_PAGES_ITERATIONS; ++i) {
+		process_flush_tlb();
+		for (u32 j = 0; j < GLOBAL_PAGES_BENCHMARK_PAGES; ++j) {
+			(void)pages[j * 1024];
+		}
+	}
+	return (u32)(util_rdtsc() - start);
+}
+
+// Compares the cost of the TLB misses after a context switch with and without global kernel pages.
+static void benchmark_global_pages() {
+	for (u32 i = 0; i < GLOBAL_PAGES_BENCHMARK_PAGES; ++i) {
+		paging_create_kernel_page_with_any_frame(GLOBAL_PAGES_BENCHMARK_ADDRESS / 0x1000 + i);
+	}
+
+	paging_set_global_pages(0);
+	u32 legacy_cycles = measure_context_switches();
+	paging_set_global_pages(1);
+	u32 cycles = measure_context_switches();
+
+	printf("benchmark: context switch touching %u kernel pages: %u cycles (without global pages: %u cycles)\n",
+		GLOBAL_PAGES_BENCHMARK_PAGES, cycles / GLOBAL_PAGES_ITERATIONS, legacy_cycles / GLOBAL_PAGES_ITERATIONS);
+	remove_benchmark_pages(GLOBAL_PAGES_BENCHMARK_ADDRESS / 0x1000, GLOBAL_PAGES_BENCHMARK_PAGES);
+}
+
+void paging_benchmark_run() {
+	benchmark_copy_frame();
+	benchmark_frame_allocator();
+	benchmark_contiguous_frames();
+	benchmark_global_pages();
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef RAW_OS_PAGING_BENCHMARK_H
+#define RAW_OS_PAGING_BENCHMARK_H
+#include "common.h"
+
+// Uncomment to run the benchmarks during boot. The benchmarks are only compiled when this is defined.
+//#define BOOT_BENCHMARKS_ENABLED
+
+#ifdef BOOT_BENCHMARKS_ENABLED
+void paging_benchmark_run();
+#endif
+#endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "asm/interrupt.h"
 #include "paging.h"
 #include "alloc/kalloc.h"
+#include "alloc/kalloc_slab.h"
 #include "asm/util.h"
 #include "util/printf.h"
 #include "asm/process.h"
@@ -14,6 +15,8 @@
 
 #define PROCESS_FILE_DESCRIPTORS_HASH_MAP_INITIAL_CAP 16
 #define INITIAL_PROCESS "shell.rawx"
+// Uncomment to print the statistics of the kernel allocators whenever a process exits (debug only)
+//#define PROCESS_PRINT_STATISTICS_ON_EXIT
 
 typedef struct Process {
 	u32 pid;
@@ -21,6 +24,7 @@ typedef struct Process {
 	u32 ebp;							// process stack base pointer
 	u32 eip;							// process instruction pointer
 	Page_Directory* page_directory;		// the page directory of this process
+	u32 temporary_mappings[TEMPORARY_MAPPING_SLOTS];	// the frames mapped to the temporary mapping slots when the process lost the CPU
 
 	Hash_Map file_descriptors;
 	s32 fd_next;
@@ -30,6 +34,9 @@ typedef struct Process {
 
 static u32 current_pid = 1;
 Process* active_process = 0;
+static Kalloc_Slab_Cache process_cache;
+// The page directory of the last process that exited, which can only be freed once we are running in another address space
+static Page_Directory* exited_page_directory = 0;
 
 s32 file_descriptor_compare(const void *key1, const void *key2) {
 	s32 fd1 = *(s32*)key1;
@@ -42,6 +49,27 @@ u32 file_descriptor_hash(const void *key) {
 	return (u32)fd;
 }
 
+// Measures how much of the kernel stack of the active process was ever used.
+// The kernel stack starts zeroed, so we look for the first non-zero dword starting from the bottom.
+// This scans the whole unused part of the stack, so it is only done when the process exits.
+static u32 get_kernel_stack_high_watermark() {
+	u32* stack_bottom = (u32*)(KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE - KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE * 0x1000);
+	u32* stack_top = (u32*)KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE;
+	u32* current = stack_bottom;
+	while (current < stack_top && *current == 0) {
+		++current;
+	}
+	return (u32)stack_top - (u32)current;
+}
+
+// Frees the page directory of the last process that exited, if any. The active process is never the one that exited.
+static void free_exited_page_directory() {
+	if (exited_page_directory) {
+		paging_free_page_directory(exited_page_directory);
+		exited_page_directory = 0;
+	}
+}
+
 static void general_protection_fault_interrupt_handler(Interrupt_Handler_Args* args) {
 	printf("General protection fault: process is doing some nasty stuff... for now, just kill it.\n");
 	process_exit(255);
@@ -51,6 +79,7 @@ void process_init() {
 	// We start by disabling interrupts
 	interrupt_disable();
 	interrupt_register_handler(general_protection_fault_interrupt_handler, ISR13);
+	kalloc_slab_cache_create(&process_cache, "process", sizeof(Process));
 
 	Vfs_Node* initrd_node = vfs_lookup(vfs_root, "initrd");
 	assert(initrd_node != 0, "Unable to initialize first process! initrd folder not found!");
@@ -59,7 +88,7 @@ void process_init() {
 
 	// Here we need to load the bash process and start it.
 	// For now, let's load a fake process.
-	active_process = kalloc_alloc(sizeof(Process));
+	active_process = kalloc_slab_alloc(&process_cache);
 	hash_map_create(&active_process->file_descriptors, PROCESS_FILE_DESCRIPTORS_HASH_MAP_INITIAL_CAP, sizeof(s32), sizeof(Vfs_Node*),
 		file_descriptor_compare, file_descriptor_hash);
 	active_process->fd_next = 0;
@@ -86,7 +115,7 @@ void process_init() {
 	// Note that the value of 'addr' is lost after the address-space switch for this reason :)
 	paging_switch_page_directory(addr);
 
-	u8* buffer = kalloc_alloc(rawx_node->size);
+	u8* buffer = paging_alloc_vm_image(active_process->page_directory, rawx_node->size);
 	vfs_read(rawx_node, 0, rawx_node->size, buffer);
 
 	// @NOTE: for this first process, we dont need to create the stack. We simply use the pages of the old kernel stack,
@@ -106,7 +135,7 @@ void process_init() {
 
 s32 process_fork() {
 	interrupt_disable();
-	Process* new_process = kalloc_alloc(sizeof(Process));
+	Process* new_process = kalloc_slab_alloc(&process_cache);
 
 	// @TODO: fork file descriptors aswell
 	// hash_map_create(&active_process->file_descriptors, PROCESS_FILE_DESCRIPTORS_HASH_MAP_INITIAL_CAP, sizeof(s32), sizeof(Vfs_Node*),
@@ -131,6 +160,7 @@ s32 process_fork() {
 		// We are the parent, so we continue creating the child process
 
 		// Clone our page directory for the child
+		// Note that our writable pages are now copy-on-write (read-only). Their TLB entries are invalidated by the clone itself.
 		new_process->page_directory = paging_clone_page_directory_for_new_process(active_process->page_directory);
 		// @TODO: copy this, not link
 		new_process->file_descriptors = active_process->file_descriptors;
@@ -138,11 +168,16 @@ s32 process_fork() {
 		// Create kernel stack for process
 		// We copy the current kernel stack to the new kernel stack.
 		// This is needed because when the new process is invoked, we wanna have the exact same kernel stack that we have right now.
+		// Only the pages that are currently in use (from esp up) are copied. The others are already zeroed by the clone.
+		u32 esp;
+		asm volatile("mov %%esp, %0" : "=r"(esp));
 		for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE; ++i) {
-			u32 page_num = (KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000) - i;
-			u32 frame_dst_addr = paging_get_page_frame_address(new_process->page_directory, page_num);
-			u32 frame_src_addr = paging_get_page_frame_address(active_process->page_directory, page_num);
-			paging_copy_frame(frame_dst_addr, frame_src_addr);
+			u32 page_num = (KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000) - 1 - i;
+			if (page_num >= esp / 0x1000) {
+				u32 frame_dst_addr = paging_get_page_frame_address(new_process->page_directory, page_num);
+				u32 frame_src_addr = paging_get_page_frame_address(active_process->page_directory, page_num);
+				paging_copy_frame(frame_dst_addr, frame_src_addr);
+			}
 		}
 
 		// Set the pid of the child
@@ -171,20 +206,20 @@ s32 process_execve(const s8* image_path) {
 		return -1;
 	}
 
-	u8* buffer = kalloc_alloc(rawx_node->size);
-	vfs_read(rawx_node, 0, rawx_node->size, buffer);
-
+	// The TLB entries of the pages that are removed here are invalidated by the clean itself.
+	// This also releases the old image, which is freed if no other process shares it.
 	paging_clean_all_non_kernel_pages_from_page_directory(active_process->page_directory);
 
+	u8* buffer = paging_alloc_vm_image(active_process->page_directory, rawx_node->size);
+	vfs_read(rawx_node, 0, rawx_node->size, buffer);
+
+	// New pages don't need TLB invalidations: the CPU never caches entries that are not present.
 	RawX_Load_Information rli = rawx_load(buffer, rawx_node->size, active_process->page_directory, 1, 0);
 
 	active_process->ebp = rli.stack_address;
 	active_process->esp = rli.stack_address;
 	active_process->eip = rli.entrypoint;
 
-	// Since we modified the page tables, we need to flush the goddamn tlb
-	process_flush_tlb();
-
 	// NOTE: interrupts will be re-enabled automatically by this function once we jump to user-mode.
 	// Here, we basically force the switch to user-mode and we tell the processor to use the
 	// stack defined by active_process->esp and to jump to the address defined by active_process->eip.
@@ -194,7 +229,14 @@ s32 process_execve(const s8* image_path) {
 
 void process_exit(u32 ret) {
 	interrupt_disable();
-	printf("Exiting from process %u with return value %u...\n", active_process->pid, ret);
+	free_exited_page_directory();
+	printf("Exiting from process %u with return value %u (kernel stack high watermark: %u bytes)...\n", active_process->pid, ret,
+		get_kernel_stack_high_watermark());
+#ifdef PROCESS_PRINT_STATISTICS_ON_EXIT
+	paging_print_zero_pool_statistics();
+	kalloc_slab_cache_print_statistics(&process_cache);
+	kalloc_print_statistics();
+#endif
 	paging_clean_all_non_kernel_pages_from_page_directory(active_process->page_directory);
 
 	Process* process_exiting = active_process;
@@ -202,7 +244,17 @@ void process_exit(u32 ret) {
 
 	process_exiting->next->previous = process_exiting->previous;
 	process_exiting->previous->next = process_exiting->next;
-	kalloc_free(process_exiting);
+#ifdef KALLOC_TRACK_CALLERS
+	// Whatever the process allocated and didn't free is still alive. Some of it might be shared (e.g. with its children),
+	// but anything that shows up here for every exiting process is a leak.
+	if (kalloc_print_callers(process_exiting->pid)) {
+		printf("Process %u allocated the blocks above, which outlive it.\n", process_exiting->pid);
+	}
+#endif
+	// We are still running on the kernel stack of the exiting process, which is part of its page directory. So the page
+	// directory is only freed later, from another address space (see 'free_exited_page_directory').
+	exited_page_directory = process_exiting->page_directory;
+	kalloc_slab_free(&process_cache, process_exiting);
 
 	if (active_process == process_exiting) {
 		// We just destroyed the last process...
@@ -222,6 +274,8 @@ void process_switch() {
 		return;
 	}
 
+	free_exited_page_directory();
+
 	// @TEMPORARY
 	if (!active_process->next) {
 		return;
@@ -240,13 +294,16 @@ void process_switch() {
 	if (eip == process_switch_context_magic_return_value) {
 		// When eip == magic_value, we know that we are the process that is receiving the CPU.
 		// The magic value is set in 'process_switch_context' implementation.
+		// We might have been preempted in the middle of a frame copy, so we restore our temporary mappings.
+		paging_restore_temporary_mappings(active_process->temporary_mappings);
 		return;
 	}
 
 	// From now on, we know that we are the process that is losing the CPU.
 
-	// Store our EIP, EBP and ESP.
+	// Store our EIP, EBP, ESP and temporary mappings.
 	active_process->eip = eip;
+	paging_get_temporary_mappings(active_process->temporary_mappings);
 	asm volatile("mov %%esp, %0" : "=r"(active_process->esp));
 	asm volatile("mov %%ebp, %0" : "=r"(active_process->ebp));
 
@@ -260,18 +317,18 @@ void process_switch() {
 	process_switch_context(active_process->eip, active_process->esp, active_process->ebp, page_directory_x86_tables_frame_addr);
 }
 
-void process_link_kernel_table_to_all_address_spaces(u32 page_table_virtual_address, u32 page_table_index, u32 page_table_x86_representation) {
-	assert(active_process != 0, "Can't link kernel table to all address spaces: there is no active process.");
-
-	// For now, just add to the end of the queue.
-	Process* current_process = active_process;
+Page_Directory* process_get_active_page_directory() {
+	if (!active_process) {
+		return 0;
+	}
+	return active_process->page_directory;
+}
 
-	do {
-		Page_Directory* current_process_page_directory = current_process->page_directory;
-		current_process_page_directory->tables[page_table_index] = (Page_Table*)page_table_virtual_address;
-		current_process_page_directory->tables_x86_representation[page_table_index] = page_table_x86_representation;
-		current_process = current_process->next;
-	} while (current_process != active_process);
+u32 process_get_active_pid() {
+	if (!active_process) {
+		return 0;
+	}
+	return active_process->pid;
 }
 
 s32 process_add_fd_to_active_process(Vfs_Node* node) {
@@ -9,6 +9,20 @@
 #define RAWX_SECTION_ADDRESS_MAXIMUM (RAWX_STACK_ADDRESS - RAWX_STACK_ADDRESS_MAX_RESERVED_PAGES * 0x1000 - RAWX_IMPORT_DATA_MAX_RESERVED_PAGES * 0x1000)
 #define RAWX_KERNEL_LIB_NAME "kernel"
 
+// Sections are not copied when the image is loaded. Instead, each section becomes a virtual memory area that copies
+// its pages from the image when they are touched for the first time (see 'paging_add_vm_area').
+// For now all section pages are writable.
+static void add_section_vm_area(Page_Directory* process_page_directory, u32 section_address, const u8* section_data, u32 size_bytes) {
+	if (size_bytes == 0) {
+		return;
+	}
+	u32 num_pages = (size_bytes + 0xFFF) / 0x1000;
+	paging_add_vm_area(process_page_directory, section_address / 0x1000, num_pages,
+		PAGING_PROTECTION_READ | PAGING_PROTECTION_WRITE | PAGING_PROTECTION_EXECUTE, section_data, size_bytes);
+}
+
+// Loads a RawX image into the given address space. Since sections are populated on demand, 'data' must be the image of
+// the address space (see 'paging_alloc_vm_image'), which is freed along with the last address space that uses it.
 RawX_Load_Information rawx_load(u8* data, s32 length, Page_Directory* process_page_directory, s32 create_stack, s32 create_kernel_stack) {
     u8* at = data;
     RawX_Header* header = (RawX_Header*)at;
@@ -29,6 +43,8 @@ RawX_Load_Information rawx_load(u8* data, s32 length, Page_Directory* process_pa
 		RAWX_LOAD_ADDRESS_MINIMUM, header->load_address);
 
 	RawX_Load_Information rli;
+	// The heap starts right after the last section
+	u32 sections_end = header->load_address;
 
 	RawX_Section* sections = (RawX_Section*)at;
     for (u32 i = 0; i < header->section_count; ++i) {
@@ -40,25 +56,14 @@ RawX_Load_Information rawx_load(u8* data, s32 length, Page_Directory* process_pa
 		assert(section_address + sec->size_bytes < RAWX_SECTION_ADDRESS_MAXIMUM,
 			"Error loading RawX: (section address + size in bytes) is too high! Got 0x%x but can't be greater than 0x%x.",
 			section_address + sec->size_bytes, RAWX_SECTION_ADDRESS_MAXIMUM);
+		sections_end = MAX(sections_end, section_address + sec->size_bytes);
 
 		if (!strcmp(sec->name, ".code")) {
 			rli.code_address = section_address;
-			for (u32 i = 0; i < sec->size_bytes; i += 0x1000) {
-				u32 target_address = section_address + i;
-				u32 page_num = target_address / 0x1000;
-				u32 data_chunk_size = MIN(0x1000, sec->size_bytes - i);
-				paging_create_process_page_with_any_frame(process_page_directory, page_num, 1);
-				memcpy((void*)target_address, section_data, data_chunk_size);
-			}
+			add_section_vm_area(process_page_directory, section_address, section_data, sec->size_bytes);
 		} else if (!strcmp(sec->name, ".data")) {
 			rli.data_address = section_address;
-			for (u32 i = 0; i < sec->size_bytes; i += 0x1000) {
-				u32 target_address = section_address + i;
-				u32 page_num = target_address / 0x1000;
-				u32 data_chunk_size = MIN(0x1000, sec->size_bytes - i);
-				paging_create_process_page_with_any_frame(process_page_directory, page_num, 1);
-				memcpy((void*)target_address, section_data, data_chunk_size);
-			}
+			add_section_vm_area(process_page_directory, section_address, section_data, sec->size_bytes);
 		} else if (!strcmp(sec->name, ".import")) {
 			u8* start = data + sec->file_ptr_to_data;
 			at = start;
@@ -96,17 +101,15 @@ RawX_Load_Information rawx_load(u8* data, s32 length, Page_Directory* process_pa
 				printf("rawx: call address 0x%x set for syscall %s.\n", *call_address, symbol_name);
 			}
 
-			// finish by copying the section, since all call addresses are set now.
-			for (u32 i = 0; i < sec->size_bytes; i += 0x1000) {
-				u32 target_address = section_address + i;
-				u32 page_num = target_address / 0x1000;
-				u32 data_chunk_size = MIN(0x1000, sec->size_bytes - i);
-				paging_create_process_page_with_any_frame(process_page_directory, page_num, 1);
-				memcpy((void*)target_address, section_data, data_chunk_size);
-			}
+			// finish by mapping the section, since all call addresses are set now.
+			add_section_vm_area(process_page_directory, section_address, section_data, sec->size_bytes);
 		}
     }
 
+	// The heap pages are created (zeroed) when they are touched for the first time, once brk makes them part of the heap.
+	rli.heap_address = (sections_end + 0xFFF) / 0x1000 * 0x1000;
+	paging_init_heap(process_page_directory, rli.heap_address, RAWX_SECTION_ADDRESS_MAXIMUM);
+
 	if (create_stack) {
 		assert(header->stack_size > 0, "Error loading RawX: stack size must be greater than 0 (got 0x%x)", header->stack_size);
 		assert(header->stack_size % 0x1000 == 0, "Error loading RawX: stack size must be 0x1000 aligned (got 0x%x)", header->stack_size);
@@ -114,18 +117,19 @@ RawX_Load_Information rawx_load(u8* data, s32 length, Page_Directory* process_pa
 		u32 stack_pages = header->stack_size / 0x1000;
 		assert(stack_pages <= RAWX_STACK_ADDRESS_MAX_RESERVED_PAGES,
 			"Error loading RawX: stack is too big! Got %u needed pages, but max is %u!", stack_pages, RAWX_STACK_ADDRESS_MAX_RESERVED_PAGES);
-		for (u32 i = 0; i < stack_pages; ++i) {
-			u32 page_num = (RAWX_STACK_ADDRESS / 0x1000) - i;
-			paging_create_process_page_with_any_frame(process_page_directory, page_num, 1);
-		}
+		// Stack pages are created (zeroed) when they are touched for the first time.
+		u32 top_page_num = RAWX_STACK_ADDRESS / 0x1000;
+		paging_add_vm_area(process_page_directory, top_page_num - stack_pages + 1, stack_pages,
+			PAGING_PROTECTION_READ | PAGING_PROTECTION_WRITE, 0, 0);
 
 		rli.stack_address = RAWX_STACK_ADDRESS;
 	}
 
 	if (create_kernel_stack) {
 		for (u32 i = 0; i < KERNEL_STACK_RESERVED_PAGES_IN_PROCESS_ADDRESS_SPACE; ++i) {
-			u32 page_num = (KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000) - i;
-			paging_create_process_page_with_any_frame(process_page_directory, page_num, 0);
+			u32 page_num = (KERNEL_STACK_ADDRESS_IN_PROCESS_ADDRESS_SPACE / 0x1000) - 1 - i;
+			// The kernel stack starts zeroed, so we are able to measure its high watermark.
+			paging_create_process_page_with_zeroed_frame(process_page_directory, page_num, 0);
 		}
 	}
 
@@ -55,6 +55,7 @@ typedef struct {
 	u32 code_address;
 	u32 data_address;
 	u32 stack_address;
+	u32 heap_address;
 	u32 entrypoint;
 } RawX_Load_Information;
 
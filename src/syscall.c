@@ -7,6 +7,7 @@
 #include "screen.h"
 #include "fs/util.h"
 #include "fs/vfs.h"
+#include "paging.h"
 
 Hash_Map syscall_stubs;
 
@@ -20,6 +21,11 @@ static const s8 OPEN_SYSCALL_NAME[] = "open";
 static const s8 READ_SYSCALL_NAME[] = "read";
 static const s8 WRITE_SYSCALL_NAME[] = "write";
 static const s8 CLOSE_SYSCALL_NAME[] = "close";
+static const s8 MMAP_SYSCALL_NAME[] = "mmap";
+static const s8 MUNMAP_SYSCALL_NAME[] = "munmap";
+static const s8 MPROTECT_SYSCALL_NAME[] = "mprotect";
+static const s8 BRK_SYSCALL_NAME[] = "brk";
+static const s8 SBRK_SYSCALL_NAME[] = "sbrk";
 
 // Compares two keys. Needs to return 1 if the keys are equal, 0 otherwise.
 static s32 syscall_stub_name_compare(const void* _key1, const void* _key2) {
@@ -111,6 +117,35 @@ static void syscall_handler(Interrupt_Handler_Args* args) {
 				args->eax = -1;
 			}
 		} break;
+		case 10: {
+			// mmap syscall
+			u32 addr = paging_mmap(process_get_active_page_directory(), args->ebx, args->ecx, args->edx);
+			args->eax = addr ? addr : (u32)-1;
+		} break;
+		case 11: {
+			// munmap syscall
+			args->eax = paging_munmap(process_get_active_page_directory(), args->ebx, args->ecx);
+		} break;
+		case 12: {
+			// mprotect syscall
+			args->eax = paging_mprotect(process_get_active_page_directory(), args->ebx, args->ecx, args->edx);
+		} break;
+		case 13: {
+			// brk syscall
+			args->eax = paging_brk(process_get_active_page_directory(), args->ebx);
+		} break;
+		case 14: {
+			// sbrk syscall: returns the old break, or -1 if the heap can't be moved
+			Page_Directory* page_directory = process_get_active_page_directory();
+			s32 increment = (s32)args->ebx;
+			u32 old_break = paging_brk(page_directory, 0);
+			u32 new_break = old_break + increment;
+			if ((increment > 0 && new_break < old_break) || (increment < 0 && new_break > old_break)) {
+				args->eax = -1;
+			} else {
+				args->eax = paging_brk(page_directory, new_break) == new_break ? old_break : (u32)-1;
+			}
+		} break;
 	}
 }
 
@@ -163,5 +198,25 @@ void syscall_init() {
 	ssi.syscall_stub_size = syscall_close_stub_size;
 	syscall_name = CLOSE_SYSCALL_NAME;
 	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
+	ssi.syscall_stub_address = (u32)syscall_mmap_stub;
+	ssi.syscall_stub_size = syscall_mmap_stub_size;
+	syscall_name = MMAP_SYSCALL_NAME;
+	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
+	ssi.syscall_stub_address = (u32)syscall_munmap_stub;
+	ssi.syscall_stub_size = syscall_munmap_stub_size;
+	syscall_name = MUNMAP_SYSCALL_NAME;
+	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
+	ssi.syscall_stub_address = (u32)syscall_mprotect_stub;
+	ssi.syscall_stub_size = syscall_mprotect_stub_size;
+	syscall_name = MPROTECT_SYSCALL_NAME;
+	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
+	ssi.syscall_stub_address = (u32)syscall_brk_stub;
+	ssi.syscall_stub_size = syscall_brk_stub_size;
+	syscall_name = BRK_SYSCALL_NAME;
+	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
+	ssi.syscall_stub_address = (u32)syscall_sbrk_stub;
+	ssi.syscall_stub_size = syscall_sbrk_stub_size;
+	syscall_name = SBRK_SYSCALL_NAME;
+	hash_map_put(&syscall_stubs, &syscall_name, &ssi);
 	interrupt_register_handler(syscall_handler, ISR128);
 }
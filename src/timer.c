@@ -3,6 +3,7 @@
 #include "util/printf.h"
 #include "interrupt.h"
 #include "process.h"
+#include "paging.h"
 
 #define PIT_CLOCK_FREQUENCY_HZ 1193180
 #define PIT_DATA_PORT_0 0x40
@@ -11,15 +12,24 @@
 #define PIT_COMMAND_PORT 0x43
 #define TIMER_DESIRED_FREQUENCY_HZ 100
 
+static u32 tick = 0;
+
 static void timer_interrupt_handler(Interrupt_Handler_Args* args) {
-	static u32 tick = 0;
 	tick++;
+	// Zeroing frames is only done when user-mode code was interrupted, so the kernel is never in the middle of something else.
+	if ((args->cs & 0x3) == 0x3) {
+		paging_zero_pool_refill(PAGING_ZERO_POOL_REFILL_FRAMES);
+	}
 	if (tick % 100 == 0) {
 		//printf("A second has passed.\n");
 		process_switch();
 	}
 }
 
+u32 timer_get_uptime_seconds() {
+	return tick / TIMER_DESIRED_FREQUENCY_HZ;
+}
+
 void timer_init() {
 	u32 divisor = PIT_CLOCK_FREQUENCY_HZ / TIMER_DESIRED_FREQUENCY_HZ;
 	io_byte_out(PIT_COMMAND_PORT, 0x36);
@@ -3,4 +3,5 @@
 #include "common.h"
 #include "interrupt.h"
 void timer_init();
+u32 timer_get_uptime_seconds();
 #endif
\ No newline at end of file
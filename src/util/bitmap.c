@@ -49,41 +49,127 @@ void bitmap_print(const Bitmap* bitmap) {
 	printf("\n");
 }
 
-void bitmap_init(Bitmap* bitmap, u8* data, u32 size) {
+void bitmap_init(Bitmap* bitmap, u8* data, u32 size, u32* summary) {
+	assert(size % 4 == 0, "bitmap_init: size must be a multiple of 4 (got %u)", size);
 	bitmap->data = data;
 	bitmap->size = size;
+	bitmap->summary = summary;
+	bitmap->first_clear_word_hint = 0;
+
+	if (summary) {
+		u32* words = (u32*)data;
+		u32 num_words = size / 4;
+		for (u32 i = 0; i < (num_words + 31) / 32; ++i) {
+			summary[i] = 0;
+		}
+		for (u32 i = 0; i < num_words; ++i) {
+			if (words[i] == 0xFFFFFFFF) {
+				summary[i / 32] |= (1u << (i % 32));
+			}
+		}
+	}
 }
 
 void bitmap_set(Bitmap* bitmap, u32 index) {
-	u32 bitmap_index = index / 8;
-	u32 bitmap_bit = index % 8;
-	assert(bitmap_index < bitmap->size * 8, "bitmap_set: bitmap_index < bitmap->size * 8 (%u < %u)", bitmap_index, bitmap->size * 8);
-	bitmap->data[bitmap_index] |= (1 << bitmap_bit);
+	u32 word_index = index / 32;
+	u32 word_bit = index % 32;
+	assert(index < bitmap->size * 8, "bitmap_set: index < bitmap->size * 8 (%u < %u)", index, bitmap->size * 8);
+	u32* word = (u32*)bitmap->data + word_index;
+	*word |= (1u << word_bit);
+	if (bitmap->summary && *word == 0xFFFFFFFF) {
+		bitmap->summary[word_index / 32] |= (1u << (word_index % 32));
+	}
 }
 
 void bitmap_clear(Bitmap* bitmap, u32 index) {
-	u32 bitmap_index = index / 8;
-	u32 bitmap_bit = index % 8;
-	assert(bitmap_index < bitmap->size * 8, "bitmap_clear: bitmap_index < bitmap->size * 8 (%u < %u)", bitmap_index, bitmap->size * 8);
-	bitmap->data[bitmap_index] &= ~(1 << bitmap_bit);
+	u32 word_index = index / 32;
+	u32 word_bit = index % 32;
+	assert(index < bitmap->size * 8, "bitmap_clear: index < bitmap->size * 8 (%u < %u)", index, bitmap->size * 8);
+	u32* word = (u32*)bitmap->data + word_index;
+	*word &= ~(1u << word_bit);
+	if (bitmap->summary) {
+		bitmap->summary[word_index / 32] &= ~(1u << (word_index % 32));
+	}
+	if (word_index < bitmap->first_clear_word_hint) {
+		bitmap->first_clear_word_hint = word_index;
+	}
 }
 
-u32 bitmap_get_first_clear(const Bitmap* bitmap) {
-	for (u32 i = 0; i < bitmap->size; ++i) {
-		for (u32 j = 0; j < 8; ++j) {
-			if (!(bitmap->data[i] & (1 << j))) {
-				return i * 8 + j;
+// Finds the first clear bit, one word at a time.
+// We start at the hint, since all words before it are known to be full. If there is a summary, full words are skipped
+// 32 at a time. Therefore, as long as bits are cleared close to the hint, this is O(1) amortized.
+u32 bitmap_get_first_clear(Bitmap* bitmap) {
+	u32* words = (u32*)bitmap->data;
+	u32 num_words = bitmap->size / 4;
+	u32 word_index = bitmap->first_clear_word_hint;
+
+	while (word_index < num_words) {
+		if (bitmap->summary) {
+			u32 summary_index = word_index / 32;
+			u32 not_full_words = ~bitmap->summary[summary_index] & (0xFFFFFFFF << (word_index % 32));
+			if (!not_full_words) {
+				word_index = (summary_index + 1) * 32;
+				continue;
+			}
+			word_index = summary_index * 32 + __builtin_ctz(not_full_words);
+			if (word_index >= num_words) {
+				break;
 			}
 		}
+
+		if (words[word_index] != 0xFFFFFFFF) {
+			bitmap->first_clear_word_hint = word_index;
+			return word_index * 32 + __builtin_ctz(~words[word_index]);
+		}
+
+		bitmap->first_clear_word_hint = word_index + 1;
+		++word_index;
 	}
 
 	panic("Bitmap full!");
 	return 0;
 }
 
+s32 bitmap_find_clear_aligned_range(const Bitmap* bitmap, u32 count, u32* index) {
+	u32* words = (u32*)bitmap->data;
+	u32 num_words = bitmap->size / 4;
+
+	if (count >= 32) {
+		// The range is made of whole words, so we look for 'count / 32' consecutive empty words.
+		u32 words_per_range = count / 32;
+		u32 first_word = bitmap->first_clear_word_hint - (bitmap->first_clear_word_hint % words_per_range);
+		for (u32 i = first_word; i + words_per_range <= num_words; i += words_per_range) {
+			u32 j = 0;
+			while (j < words_per_range && words[i + j] == 0) {
+				++j;
+			}
+			if (j == words_per_range) {
+				*index = i * 32;
+				return 0;
+			}
+		}
+	} else {
+		// The range fits in a single word.
+		u32 mask = (1u << count) - 1;
+		for (u32 i = bitmap->first_clear_word_hint; i < num_words; ++i) {
+			if (words[i] == 0xFFFFFFFF) {
+				continue;
+			}
+			for (u32 bit = 0; bit < 32; bit += count) {
+				if (!(words[i] & (mask << bit))) {
+					*index = i * 32 + bit;
+					return 0;
+				}
+			}
+		}
+	}
+
+	return -1;
+}
+
 u32 bitmap_get(const Bitmap* bitmap, u32 index) {
 	u32 bitmap_index = index / 8;
 	u32 bitmap_bit = index % 8;
-	assert(bitmap_index < bitmap->size * 8, "bitmap_get: bitmap_index < bitmap->size * 8 (%u < %u)", bitmap_index, bitmap->size * 8);
+	assert(index < bitmap->size * 8, "bitmap_get: index < bitmap->size * 8 (%u < %u)", index, bitmap->size * 8);
 	return (bitmap->data[bitmap_index] & (1 << bitmap_bit)) != 0;
 }
\ No newline at end of file
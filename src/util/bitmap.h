@@ -4,13 +4,22 @@
 typedef struct {
 	u8* data;
 	u32 size;
+	// Optional summary of the bitmap, with one bit per 32-bit word of 'data'. The bit is set if the word is full.
+	u32* summary;
+	// All words of 'data' before this one are known to be full.
+	u32 first_clear_word_hint;
 } Bitmap;
 
 // NOTE: the size is given in BYTES. So, in order to create a bitmap with 32 elements, size would be 4.
-void bitmap_init(Bitmap* bitmap, u8* data, u32 size);
+// The size must be a multiple of 4 and 'data' must be 4-byte aligned, since the bitmap is scanned one word at a time.
+// 'summary' is optional (it can be 0). If given, it must have space for (size / 4) bits, rounded up to a multiple of 32.
+void bitmap_init(Bitmap* bitmap, u8* data, u32 size, u32* summary);
 void bitmap_set(Bitmap* bitmap, u32 index);
 void bitmap_clear(Bitmap* bitmap, u32 index);
-u32 bitmap_get_first_clear(const Bitmap* bitmap);
+u32 bitmap_get_first_clear(Bitmap* bitmap);
+// Finds 'count' consecutive clear bits, starting at an index that is a multiple of 'count'. 'count' must be a power of 2.
+// Returns 0 if found (and fills 'index'), -1 otherwise.
+s32 bitmap_find_clear_aligned_range(const Bitmap* bitmap, u32 count, u32* index);
 u32 bitmap_get(const Bitmap* bitmap, u32 index);
 void bitmap_print(const Bitmap* bitmap);
 #endif
\ No newline at end of file
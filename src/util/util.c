@@ -31,8 +31,19 @@ s32 strcmp(const s8* s1, const s8* s2) {
 }
 
 void memcpy(void* dst, const void* src, u32 size) {
-	for (u32 i = 0; i < size; ++i) {
-		*((s8*)dst + i) = *((s8*)src + i);
+	u8* d = dst;
+	const u8* s = src;
+	// If both pointers have the same alignment, copy 4 bytes at a time after aligning them
+	if ((((u32)d ^ (u32)s) & 3) == 0) {
+		for (; size > 0 && ((u32)d & 3); --size) {
+			*d++ = *s++;
+		}
+		for (; size >= 4; size -= 4, d += 4, s += 4) {
+			*(u32*)d = *(const u32*)s;
+		}
+	}
+	for (; size > 0; --size) {
+		*d++ = *s++;
 	}
 }
 